@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/mman.h>
+#include "util.h"
+#include "stats.h"
+#include "arena.h"
+
+#define ARENA_HUGE_PAGE_SIZE ((size_t)2 << 20)
+// keeps the first allocation in a block cache line aligned
+#define ARENA_HEADER_SIZE ((sizeof(arena_block_s) + 63) & ~(size_t)63)
+
+static inline size_t align_up(size_t value, size_t align) {
+    assert(align > 0 && (align & (align - 1)) == 0);
+    return (value + align - 1) & ~(align - 1);
+}
+
+static arena_block_s *map_block(arena_s *arena, size_t size) {
+    size = align_up(size, ARENA_HUGE_PAGE_SIZE);
+    int prot = PROT_READ | PROT_WRITE;
+    int map_flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+    void *base = MAP_FAILED;
+    if (arena->flags & ARENA_HUGETLB) {
+        // without MAP_NORESERVE the pool pages are reserved here, so a pool
+        // that is too small fails the mmap instead of the first touch
+        base = mmap(NULL, size, prot, map_flags | MAP_HUGETLB, -1, 0);
+    }
+    if (base == MAP_FAILED) {
+        base = mmap(NULL, size, prot, map_flags, -1, 0);
+        perr_die_if(base == MAP_FAILED, "mmap");
+        if (arena->flags & (ARENA_THP | ARENA_HUGETLB)) {
+            // only a hint, the kernel may not have thp enabled
+            madvise(base, size, MADV_HUGEPAGE);
+        }
+    }
+    stats_add_arena_bytes(size);
+
+    arena_block_s *block = base;
+    block->prev = arena->current;
+    block->size = size;
+    block->used = ARENA_HEADER_SIZE;
+    block->dirty = ARENA_HEADER_SIZE;
+    block->start = arena->current ? arena->current->start + arena->current->size : 0;
+    arena->current = block;
+    return block;
+}
+
+static void unmap_block(arena_s *arena) {
+    arena_block_s *block = arena->current;
+    arena->current = block->prev;
+    stats_add_arena_bytes(-(int64_t)block->size);
+    perr_die_if(munmap(block, block->size) != 0, "munmap");
+}
+
+arena_s arena_create(unsigned int flags) {
+    arena_s result = {
+        .flags = flags,
+        .next_block_size = ARENA_DEFAULT_BLOCK_SIZE,
+    };
+    return result;
+}
+
+void arena_free(arena_s *arena) {
+    while (arena->current) {
+        unmap_block(arena);
+    }
+}
+
+void *arena_push_size(arena_s *arena, size_t size, size_t align) {
+    arena_block_s *block = arena->current;
+    size_t offset = block ? align_up(block->used, align) : 0;
+    if (!block || offset + size > block->size || offset + size < offset) {
+        size_t needed = ARENA_HEADER_SIZE + align + size;
+        die_if(needed < size, "Arena allocation too large: %zu bytes\n", size);
+        block = map_block(arena, needed > arena->next_block_size ? needed : arena->next_block_size);
+        if (arena->next_block_size < ARENA_MAX_BLOCK_SIZE) {
+            arena->next_block_size *= 2;
+        }
+        offset = align_up(block->used, align);
+    }
+    block->used = offset + size;
+    if (block->used > block->dirty) {
+        block->dirty = block->used;
+    }
+    return (uint8_t *)block + offset;
+}
+
+void *arena_push_size_zero(arena_s *arena, size_t size, size_t align) {
+    // memory past the block's dirty mark has never been touched, and is already zero
+    size_t old_dirty = arena->current ? arena->current->dirty : 0;
+    arena_block_s *old_block = arena->current;
+    uint8_t *result = arena_push_size(arena, size, align);
+    if (arena->current == old_block) {
+        size_t offset = result - (uint8_t *)old_block;
+        if (offset < old_dirty) {
+            size_t dirty = old_dirty - offset;
+            memset(result, 0, dirty < size ? dirty : size);
+        }
+    }
+    return result;
+}
+
+void *arena_extend(arena_s *arena, void *ptr, size_t old_size, size_t add, size_t align) {
+    arena_block_s *block = arena->current;
+    if (ptr && block &&
+        (uint8_t *)ptr + old_size == (uint8_t *)block + block->used &&
+        block->used + add <= block->size) {
+        block->used += add;
+        if (block->used > block->dirty) {
+            block->dirty = block->used;
+        }
+        return ptr;
+    }
+    void *result = arena_push_size(arena, old_size + add, align);
+    if (old_size > 0) {
+        memcpy(result, ptr, old_size);
+    }
+    return result;
+}
+
+size_t arena_mark(arena_s *arena) {
+    return arena->current ? arena->current->start + arena->current->used : 0;
+}
+
+void arena_pop_to(arena_s *arena, size_t mark) {
+    // positions inside a block are always past its start, by the header.
+    // The first block is kept until arena_free, so that popping back to an
+    // empty arena in a loop doesn't map and fault it in again every time.
+    while (arena->current && arena->current->prev && mark <= arena->current->start) {
+        unmap_block(arena);
+    }
+    if (arena->current) {
+        if (mark < ARENA_HEADER_SIZE) {
+            assert(mark == 0 && !arena->current->prev);
+            mark = ARENA_HEADER_SIZE;
+        }
+        assert(mark >= arena->current->start + ARENA_HEADER_SIZE);
+        assert(mark <= arena->current->start + arena->current->used);
+        arena->current->used = mark - arena->current->start;
+    }
+}
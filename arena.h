@@ -0,0 +1,62 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A linear allocator over a chain of mmapped blocks. Blocks are mapped on
+// demand and sized to what is pushed, doubling as the arena grows, so no
+// more than roughly twice the memory in use is ever mapped.
+
+// the first block, later ones double up to ARENA_MAX_BLOCK_SIZE
+#define ARENA_DEFAULT_BLOCK_SIZE ((size_t)64 << 20)
+#define ARENA_MAX_BLOCK_SIZE ((size_t)1 << 30)
+
+typedef enum {
+    // ask for transparent huge pages with madvise
+    ARENA_THP = 1 << 0,
+    // map from the hugetlbfs pool, falling back to ARENA_THP for any block
+    // the pool can't cover
+    ARENA_HUGETLB = 1 << 1,
+} ARENA_FLAGS;
+
+typedef struct arena_block_s {
+    struct arena_block_s *prev;
+    // all in bytes from the start of the mapping, which holds this header
+    size_t size;
+    size_t used;
+    // high water mark of used, everything past it is still zero
+    size_t dirty;
+    // position of the start of the block across the whole arena
+    size_t start;
+} arena_block_s;
+
+typedef struct {
+    arena_block_s *current;
+    unsigned int flags;
+    size_t next_block_size;
+} arena_s;
+
+arena_s arena_create(unsigned int flags);
+void arena_free(arena_s *arena);
+
+void *arena_push_size(arena_s *arena, size_t size, size_t align);
+void *arena_push_size_zero(arena_s *arena, size_t size, size_t align);
+
+// Grows ptr, which holds old_size bytes, by add bytes. This is free when
+// ptr is the last allocation and the block has room, otherwise it is
+// copied to the top of the arena. Returns the possibly moved pointer.
+void *arena_extend(arena_s *arena, void *ptr, size_t old_size, size_t add, size_t align);
+
+// everything pushed after the mark is released, and blocks mapped after it
+// are unmapped, apart from the first block
+size_t arena_mark(arena_s *arena);
+void arena_pop_to(arena_s *arena, size_t mark);
+
+#define arena_push_array(arena, type, count) \
+    ((type *)arena_push_size((arena), sizeof(type) * (count), _Alignof(type)))
+#define arena_push_array_zero(arena, type, count) \
+    ((type *)arena_push_size_zero((arena), sizeof(type) * (count), _Alignof(type)))
+
+#endif
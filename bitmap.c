@@ -0,0 +1,369 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <futile.h>
+#include "util.h"
+#include "bitmap.h"
+
+// sort keys are the zoom above the morton code, which is at most 40 bits
+#define BITMAP_ZOOM_SHIFT 42
+#define BITMAP_MORTON_MASK (((uint64_t)1 << BITMAP_ZOOM_SHIFT) - 1)
+#define BITMAP_RADIX_BITS 16
+#define BITMAP_RADIX_MIN 8192
+
+static inline uint64_t spread_bits(uint32_t value) {
+    uint64_t x = value;
+    x = (x | (x << 16)) & 0x0000FFFF0000FFFFull;
+    x = (x | (x << 8)) & 0x00FF00FF00FF00FFull;
+    x = (x | (x << 4)) & 0x0F0F0F0F0F0F0F0Full;
+    x = (x | (x << 2)) & 0x3333333333333333ull;
+    x = (x | (x << 1)) & 0x5555555555555555ull;
+    return x;
+}
+
+uint64_t morton_encode(uint32_t x, uint32_t y) {
+    return spread_bits(x) | (spread_bits(y) << 1);
+}
+
+static int compare_keys(const void *a_, const void *b_) {
+    uint64_t a = *(const uint64_t *)a_, b = *(const uint64_t *)b_;
+    return (a > b) - (a < b);
+}
+
+// Sorts with an lsd radix sort over just the bits that vary between the
+// smallest and largest key. Below BITMAP_RADIX_MIN keys, clearing and
+// summing the radix counts costs more than a comparison sort. Returns
+// whichever of keys and the scratch buffer holds the result.
+static uint64_t *sort_keys(arena_s *scratch, uint64_t *keys, size_t n) {
+    if (n < BITMAP_RADIX_MIN) {
+        qsort(keys, n, sizeof(uint64_t), compare_keys);
+        return keys;
+    }
+
+    uint64_t min = keys[0], max = keys[0];
+    for (size_t i = 1; i < n; i++) {
+        if (keys[i] < min) min = keys[i];
+        if (keys[i] > max) max = keys[i];
+    }
+    unsigned int range_bits = max > min ? 64 - __builtin_clzll(max - min) : 0;
+    unsigned int n_passes = (range_bits + BITMAP_RADIX_BITS - 1) / BITMAP_RADIX_BITS;
+    if (n_passes == 0) {
+        return keys;
+    }
+
+    size_t n_buckets = (size_t)1 << BITMAP_RADIX_BITS;
+    uint64_t *tmp = arena_push_array(scratch, uint64_t, n);
+    size_t *counts = arena_push_array(scratch, size_t, n_buckets);
+    for (unsigned int pass = 0; pass < n_passes; pass++) {
+        unsigned int shift = pass * BITMAP_RADIX_BITS;
+        memset(counts, 0, sizeof(size_t) * n_buckets);
+        for (size_t i = 0; i < n; i++) {
+            counts[((keys[i] - min) >> shift) & (n_buckets - 1)]++;
+        }
+        size_t offset = 0;
+        for (size_t bucket = 0; bucket < n_buckets; bucket++) {
+            size_t count = counts[bucket];
+            counts[bucket] = offset;
+            offset += count;
+        }
+        for (size_t i = 0; i < n; i++) {
+            tmp[counts[((keys[i] - min) >> shift) & (n_buckets - 1)]++] = keys[i];
+        }
+        uint64_t *swap = keys;
+        keys = tmp;
+        tmp = swap;
+    }
+    return keys;
+}
+
+static bitmap_container_s container_from_words(arena_s *arena, uint64_t *words) {
+    uint32_t cardinality = 0;
+    for (unsigned int word_index = 0; word_index < BITMAP_WORDS; word_index++) {
+        cardinality += __builtin_popcountll(words[word_index]);
+    }
+    bitmap_container_s result = {.cardinality = cardinality};
+    if (cardinality == 0) {
+        return result;
+    }
+    if (cardinality <= BITMAP_ARRAY_MAX) {
+        result.values = arena_push_array(arena, uint16_t, cardinality);
+        uint32_t value_index = 0;
+        for (unsigned int word_index = 0; word_index < BITMAP_WORDS; word_index++) {
+            for (uint64_t word = words[word_index]; word; word &= word - 1) {
+                result.values[value_index++] = word_index * 64 + __builtin_ctzll(word);
+            }
+        }
+    } else {
+        result.words = arena_push_array(arena, uint64_t, BITMAP_WORDS);
+        memcpy(result.words, words, sizeof(uint64_t) * BITMAP_WORDS);
+    }
+    return result;
+}
+
+static void container_to_words(bitmap_container_s *container, uint64_t *words) {
+    if (container->words) {
+        memcpy(words, container->words, sizeof(uint64_t) * BITMAP_WORDS);
+    } else {
+        memset(words, 0, sizeof(uint64_t) * BITMAP_WORDS);
+        for (uint32_t i = 0; i < container->cardinality; i++) {
+            uint16_t value = container->values[i];
+            words[value >> 6] |= (uint64_t)1 << (value & 63);
+        }
+    }
+}
+
+static bitmap_container_s container_from_values(arena_s *arena, uint16_t *values, uint32_t n) {
+    if (n > BITMAP_ARRAY_MAX) {
+        uint64_t words[BITMAP_WORDS] = {0};
+        for (uint32_t i = 0; i < n; i++) {
+            words[values[i] >> 6] |= (uint64_t)1 << (values[i] & 63);
+        }
+        return container_from_words(arena, words);
+    }
+    bitmap_container_s result = {.cardinality = n};
+    if (n > 0) {
+        result.values = arena_push_array(arena, uint16_t, n);
+        memcpy(result.values, values, sizeof(uint16_t) * n);
+    }
+    return result;
+}
+
+static bitmap_container_s container_copy(arena_s *arena, bitmap_container_s *container) {
+    if (container->words) {
+        return container_from_words(arena, container->words);
+    }
+    return container_from_values(arena, container->values, container->cardinality);
+}
+
+static inline bool container_contains(bitmap_container_s *container, uint16_t value) {
+    if (container->words) {
+        return (container->words[value >> 6] >> (value & 63)) & 1;
+    }
+    uint32_t lo = 0, hi = container->cardinality;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (container->values[mid] < value) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo < container->cardinality && container->values[lo] == value;
+}
+
+static uint32_t container_and_cardinality(bitmap_container_s *a, bitmap_container_s *b) {
+    uint32_t result = 0;
+    if (a->words && b->words) {
+        for (unsigned int word_index = 0; word_index < BITMAP_WORDS; word_index++) {
+            result += __builtin_popcountll(a->words[word_index] & b->words[word_index]);
+        }
+    } else if (a->words || b->words) {
+        bitmap_container_s *array = a->words ? b : a;
+        uint64_t *words = a->words ? a->words : b->words;
+        for (uint32_t i = 0; i < array->cardinality; i++) {
+            uint16_t value = array->values[i];
+            result += (words[value >> 6] >> (value & 63)) & 1;
+        }
+    } else {
+        uint32_t i = 0, j = 0;
+        while (i < a->cardinality && j < b->cardinality) {
+            if (a->values[i] < b->values[j]) {
+                i++;
+            } else if (a->values[i] > b->values[j]) {
+                j++;
+            } else {
+                result++;
+                i++;
+                j++;
+            }
+        }
+    }
+    return result;
+}
+
+static bitmap_container_s container_op(arena_s *arena, bitmap_container_s *a, bitmap_container_s *b, BITMAP_OP op) {
+    if (!a->words && !b->words) {
+        // merge the sorted arrays
+        uint16_t values[2 * BITMAP_ARRAY_MAX];
+        uint32_t n = 0, i = 0, j = 0;
+        while (i < a->cardinality || j < b->cardinality) {
+            bool take_a = j == b->cardinality ||
+                (i < a->cardinality && a->values[i] < b->values[j]);
+            bool take_b = i == a->cardinality ||
+                (j < b->cardinality && b->values[j] < a->values[i]);
+            if (take_a) {
+                if (op != BITMAP_AND) values[n++] = a->values[i];
+                i++;
+            } else if (take_b) {
+                if (op == BITMAP_OR) values[n++] = b->values[j];
+                j++;
+            } else {
+                if (op != BITMAP_ANDNOT) values[n++] = a->values[i];
+                i++;
+                j++;
+            }
+        }
+        return container_from_values(arena, values, n);
+    }
+
+    uint64_t a_words[BITMAP_WORDS], b_words[BITMAP_WORDS];
+    container_to_words(a, a_words);
+    container_to_words(b, b_words);
+    for (unsigned int word_index = 0; word_index < BITMAP_WORDS; word_index++) {
+        switch (op) {
+            case BITMAP_AND: a_words[word_index] &= b_words[word_index]; break;
+            case BITMAP_OR: a_words[word_index] |= b_words[word_index]; break;
+            case BITMAP_ANDNOT: a_words[word_index] &= ~b_words[word_index]; break;
+        }
+    }
+    return container_from_words(arena, a_words);
+}
+
+coord_bitmap_s create_coord_bitmap(arena_s *arena, arena_s *scratch, uint64_t *coord_ints, size_t n) {
+    coord_bitmap_s result = {};
+    if (n == 0) {
+        return result;
+    }
+
+    size_t mark = arena_mark(scratch);
+    uint64_t *keys = arena_push_array(scratch, uint64_t, n);
+    size_t n_keys = 0;
+    futile_coord_s coord;
+    for (size_t coord_int_index = 0; coord_int_index < n; coord_int_index++) {
+        futile_coord_unmarshall_int(coord_ints[coord_int_index], &coord);
+        if (coord.z < 0 || coord.z > BITMAP_MAX_ZOOM) continue;
+        keys[n_keys++] = ((uint64_t)coord.z << BITMAP_ZOOM_SHIFT) | morton_encode(coord.x, coord.y);
+    }
+    keys = sort_keys(scratch, keys, n_keys);
+
+    size_t key_index = 0;
+    while (key_index < n_keys) {
+        unsigned int z = keys[key_index] >> BITMAP_ZOOM_SHIFT;
+        size_t zoom_until = key_index;
+        size_t n_containers = 0;
+        for (; zoom_until < n_keys && keys[zoom_until] >> BITMAP_ZOOM_SHIFT == z; zoom_until++) {
+            if (zoom_until == key_index || keys[zoom_until] >> 16 != keys[zoom_until - 1] >> 16) {
+                n_containers++;
+            }
+        }
+
+        zoom_bitmap_s *zoom_bitmap = result.zooms + z;
+        zoom_bitmap->keys = arena_push_array(arena, uint64_t, n_containers);
+        zoom_bitmap->containers = arena_push_array(arena, bitmap_container_s, n_containers);
+
+        uint16_t values[65536];
+        while (key_index < zoom_until) {
+            uint64_t high = keys[key_index] >> 16;
+            uint32_t n_values = 0;
+            for (; key_index < zoom_until && keys[key_index] >> 16 == high; key_index++) {
+                uint16_t value = keys[key_index] & 0xFFFF;
+                // the keys are sorted, so duplicates are adjacent
+                if (n_values == 0 || values[n_values - 1] != value) {
+                    values[n_values++] = value;
+                }
+            }
+            size_t container_index = zoom_bitmap->n_containers++;
+            zoom_bitmap->keys[container_index] = high & (BITMAP_MORTON_MASK >> 16);
+            zoom_bitmap->containers[container_index] = container_from_values(arena, values, n_values);
+        }
+    }
+
+    arena_pop_to(scratch, mark);
+    return result;
+}
+
+static bitmap_container_s *find_container(zoom_bitmap_s *bitmap, uint64_t key) {
+    size_t lo = 0, hi = bitmap->n_containers;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (bitmap->keys[mid] < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo < bitmap->n_containers && bitmap->keys[lo] == key) {
+        return bitmap->containers + lo;
+    }
+    return NULL;
+}
+
+bool bitmap_contains_coord(coord_bitmap_s *bitmap, uint64_t coord_int) {
+    futile_coord_s coord;
+    futile_coord_unmarshall_int(coord_int, &coord);
+    if (coord.z < 0 || coord.z > BITMAP_MAX_ZOOM) {
+        return false;
+    }
+    uint64_t morton = morton_encode(coord.x, coord.y);
+    bitmap_container_s *container = find_container(bitmap->zooms + coord.z, morton >> 16);
+    return container && container_contains(container, morton & 0xFFFF);
+}
+
+uint64_t zoom_bitmap_cardinality(zoom_bitmap_s *bitmap) {
+    uint64_t result = 0;
+    for (size_t i = 0; i < bitmap->n_containers; i++) {
+        result += bitmap->containers[i].cardinality;
+    }
+    return result;
+}
+
+uint64_t zoom_bitmap_and_cardinality(zoom_bitmap_s *a, zoom_bitmap_s *b) {
+    uint64_t result = 0;
+    size_t i = 0, j = 0;
+    while (i < a->n_containers && j < b->n_containers) {
+        if (a->keys[i] < b->keys[j]) {
+            i++;
+        } else if (a->keys[i] > b->keys[j]) {
+            j++;
+        } else {
+            result += container_and_cardinality(a->containers + i, b->containers + j);
+            i++;
+            j++;
+        }
+    }
+    return result;
+}
+
+zoom_bitmap_s zoom_bitmap_op(arena_s *arena, zoom_bitmap_s *a, zoom_bitmap_s *b, BITMAP_OP op) {
+    size_t capacity = a->n_containers + (op == BITMAP_OR ? b->n_containers : 0);
+    zoom_bitmap_s result = {
+        .keys = arena_push_array(arena, uint64_t, capacity),
+        .containers = arena_push_array(arena, bitmap_container_s, capacity),
+    };
+
+    size_t i = 0, j = 0;
+    while (i < a->n_containers || j < b->n_containers) {
+        bitmap_container_s container = {};
+        uint64_t key;
+        if (j == b->n_containers || (i < a->n_containers && a->keys[i] < b->keys[j])) {
+            key = a->keys[i];
+            if (op != BITMAP_AND) container = container_copy(arena, a->containers + i);
+            i++;
+        } else if (i == a->n_containers || b->keys[j] < a->keys[i]) {
+            key = b->keys[j];
+            if (op == BITMAP_OR) container = container_copy(arena, b->containers + j);
+            j++;
+        } else {
+            key = a->keys[i];
+            container = container_op(arena, a->containers + i, b->containers + j, op);
+            i++;
+            j++;
+        }
+        if (container.cardinality > 0) {
+            assert(result.n_containers < capacity);
+            result.keys[result.n_containers] = key;
+            result.containers[result.n_containers] = container;
+            result.n_containers++;
+        }
+    }
+    return result;
+}
+
+coord_bitmap_s coord_bitmap_op(arena_s *arena, coord_bitmap_s *a, coord_bitmap_s *b, BITMAP_OP op) {
+    coord_bitmap_s result;
+    for (unsigned int z = 0; z <= BITMAP_MAX_ZOOM; z++) {
+        result.zooms[z] = zoom_bitmap_op(arena, a->zooms + z, b->zooms + z, op);
+    }
+    return result;
+}
@@ -0,0 +1,58 @@
+#ifndef BITMAP_H
+#define BITMAP_H
+
+#include "util.h"
+
+// Roaring style compressed bitmaps of coords, one per zoom. Within a zoom a
+// coord is its morton code, the interleaved bits of x and y. The high bits
+// of the code pick a container, and the low 16 bits are stored in it,
+// either as a sorted array when sparse or as a 65536 bit bitset when dense.
+// Set operations and cardinalities then work a container at a time, mostly
+// as word level bit operations.
+
+#define BITMAP_MAX_ZOOM 20
+// containers past this many values are stored as bitsets
+#define BITMAP_ARRAY_MAX 4096
+#define BITMAP_WORDS (65536 / 64)
+
+typedef struct {
+    // exactly one of these is set
+    uint16_t *values;
+    uint64_t *words;
+    uint32_t cardinality;
+} bitmap_container_s;
+
+typedef struct {
+    // sorted, the morton code >> 16 of each container
+    uint64_t *keys;
+    bitmap_container_s *containers;
+    size_t n_containers;
+} zoom_bitmap_s;
+
+typedef struct {
+    zoom_bitmap_s zooms[BITMAP_MAX_ZOOM + 1];
+} coord_bitmap_s;
+
+typedef enum {
+    BITMAP_AND,
+    BITMAP_OR,
+    BITMAP_ANDNOT,
+} BITMAP_OP;
+
+uint64_t morton_encode(uint32_t x, uint32_t y);
+
+// The bitmap is allocated in arena, and scratch is only used while
+// building. Duplicate coords are stored once, and anything past
+// BITMAP_MAX_ZOOM is dropped.
+coord_bitmap_s create_coord_bitmap(arena_s *arena, arena_s *scratch, uint64_t *coord_ints, size_t n);
+
+bool bitmap_contains_coord(coord_bitmap_s *bitmap, uint64_t coord_int);
+
+uint64_t zoom_bitmap_cardinality(zoom_bitmap_s *bitmap);
+// the size of the intersection, without building it
+uint64_t zoom_bitmap_and_cardinality(zoom_bitmap_s *a, zoom_bitmap_s *b);
+zoom_bitmap_s zoom_bitmap_op(arena_s *arena, zoom_bitmap_s *a, zoom_bitmap_s *b, BITMAP_OP op);
+
+coord_bitmap_s coord_bitmap_op(arena_s *arena, coord_bitmap_s *a, coord_bitmap_s *b, BITMAP_OP op);
+
+#endif
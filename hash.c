@@ -3,103 +3,90 @@
 #include <futile.h>
 #include "util.h"
 #include "hash.h"
+#include "stats.h"
 
-unsigned int find_nearest_power_2_lower(unsigned int x) {
-    int power = 1;
+size_t find_nearest_power_2_lower(size_t x) {
+    size_t power = 1;
     while (x >>= 1) power <<= 1;
     return power;
 }
 
-unsigned int find_nearest_power_2_higher(unsigned int x) {
-    int power = 2;
+size_t find_nearest_power_2_higher(size_t x) {
+    size_t power = 2;
     while (x >>= 1) power <<= 1;
     return power;
 }
 
-unsigned int calc_coord_int_hash(uint64_t coord_int) {
-    const int prime = 12289;
+uint64_t calc_coord_int_hash(uint64_t coord_int) {
+    const uint64_t prime = 12289;
     futile_coord_s coord;
     futile_coord_unmarshall_int(coord_int, &coord);
-    unsigned int result;
+    uint64_t result;
     result = coord.z;
     result = result * prime + coord.x;
     result = result * prime + coord.y;
     return result;
 }
 
-coord_hash_table_s create_coord_hash(coord_ints_s *coord_ints) {
-    unsigned int hash_size = find_nearest_power_2_lower(coord_ints->n);
-
-    unsigned int size_entries = sizeof(coord_hash_entry_s) * coord_ints->n;
-    unsigned int size_buckets = sizeof(coord_hash_entry_s *) * hash_size;
-    unsigned int total_memory = size_entries + size_buckets;
-    void *memory = malloc(total_memory);
-    memset(memory, 0, total_memory);
-
-    coord_hash_entry_s **buckets = (coord_hash_entry_s **)memory;
-    coord_hash_entry_s *entries = (coord_hash_entry_s *)(buckets + hash_size);
-    for (size_t coord_ints_index = 0;
-        coord_ints_index < coord_ints->n;
-        coord_ints_index++) {
-        coord_hash_entry_s *entry = entries + coord_ints_index;
-        entry->coord_int = coord_ints->coord_ints[coord_ints_index];
+static inline size_t coord_int_bucket(uint64_t coord_int, size_t hash_size) {
+    return calc_coord_int_hash(coord_int) & (hash_size - 1);
+}
 
-        unsigned int hashcode = calc_coord_int_hash(entry->coord_int);
-        size_t bucket_index = hashcode & (hash_size - 1);
+static size_t coord_int_bucket_key(uint64_t coord_int, void *data) {
+    return coord_int_bucket(coord_int, *(size_t *)data);
+}
 
-        coord_hash_entry_s *location = buckets[bucket_index];
-        entry->next = location;
-        buckets[bucket_index] = entry;
-    }
+coord_hash_table_s create_coord_hash_strided(arena_s *arena, void *entries, size_t n, size_t stride) {
+    size_t hash_size = find_nearest_power_2_lower(n);
+    size_t *offsets = partition_in_place(
+        arena, entries, n, stride, hash_size, coord_int_bucket_key, &hash_size);
     coord_hash_table_s result = {
-        .buckets = buckets,
+        .entries = entries,
+        .stride = stride,
+        .offsets = offsets,
         .size = hash_size,
     };
-
     return result;
 }
 
-void print_hash_stats(coord_hash_table_s *table) {
-    const size_t lengths_size = 10000;
-    unsigned int lengths[lengths_size];
-    memset(lengths, 0, sizeof(lengths));
+coord_hash_table_s create_coord_hash(arena_s *arena, coord_ints_s *coord_ints) {
+    return create_coord_hash_strided(arena, coord_ints->coord_ints, coord_ints->n, sizeof(uint64_t));
+}
+
+void record_hash_stats(char *name, coord_hash_table_s *table) {
+    stats_table_s *stats_table = stats_add_table(name);
+    if (!stats_table) {
+        return;
+    }
+    stats_table->n_buckets += table->size;
     for (size_t bucket_index = 0;
         bucket_index < table->size;
         bucket_index++) {
-        coord_hash_entry_s *entry = table->buckets[bucket_index];
-        if (entry) {
-            unsigned int length = 0;
-            while (entry) {
-                length++;
-                entry = entry->next;
-            }
-            if (length > lengths_size) {
-                length = lengths_size;
-            }
-            lengths[length-1]++;
-        }
-    }
-    for (size_t length_index = 0; length_index < lengths_size; length_index++) {
-        unsigned int length = lengths[length_index];
+        size_t length = table->offsets[bucket_index + 1] - table->offsets[bucket_index];
         if (length > 0) {
-            printf("%2zu: %u\n", length_index + 1, length);
+            stats_table->n_entries += length;
+            if (length > STATS_MAX_LENGTH) {
+                length = STATS_MAX_LENGTH;
+            }
+            stats_table->chain_lengths[length]++;
+        } else {
+            stats_table->n_empty_buckets++;
         }
     }
 }
 
 bool table_contains_coord(coord_hash_table_s *table, uint64_t coord_int) {
     bool result = false;
-    unsigned int hashcode = calc_coord_int_hash(coord_int);
-    size_t bucket = hashcode & (table->size - 1);
-    for (coord_hash_entry_s *entry = table->buckets[bucket]; entry; entry = entry->next) {
-        if (entry->coord_int == coord_int) {
+    unsigned int probe_length = 0;
+    size_t bucket = coord_int_bucket(coord_int, table->size);
+    size_t until = table->offsets[bucket + 1];
+    for (size_t entry_index = table->offsets[bucket]; entry_index < until; entry_index++) {
+        probe_length++;
+        if (table_coord_int_at(table, entry_index) == coord_int) {
             result = true;
             break;
         }
     }
+    stats_record_probe(probe_length, result);
     return result;
 }
-
-void free_coord_table(coord_hash_table_s *table) {
-    free(table->buckets);
-}
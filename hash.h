@@ -3,25 +3,33 @@
 
 #include "util.h"
 
-typedef struct coord_hash_entry_s {
-    uint64_t coord_int;
-    struct coord_hash_entry_s *next;
-} coord_hash_entry_s;
-
+// The table doesn't own its entries. Building it reorders the caller's
+// array in place so that each bucket is a contiguous run, and only the
+// bucket offsets are allocated. Entries can be any struct whose first
+// member is the uint64_t coord int.
 typedef struct {
-    coord_hash_entry_s **buckets;
+    uint8_t *entries;
+    size_t stride;
+    // size + 1 offsets, bucket i is [offsets[i], offsets[i+1])
+    size_t *offsets;
     size_t size;
 } coord_hash_table_s;
 
-unsigned int find_nearest_power_2_lower(unsigned int x);
-unsigned int find_nearest_power_2_higher(unsigned int x);
+size_t find_nearest_power_2_lower(size_t x);
+size_t find_nearest_power_2_higher(size_t x);
 
-unsigned int calc_coord_int_hash(uint64_t coord_int);
+uint64_t calc_coord_int_hash(uint64_t coord_int);
 
-coord_hash_table_s create_coord_hash(coord_ints_s *coord_ints);
+coord_hash_table_s create_coord_hash(arena_s *arena, coord_ints_s *coord_ints);
+coord_hash_table_s create_coord_hash_strided(arena_s *arena, void *entries, size_t n, size_t stride);
 
-bool table_contains_coord(coord_hash_table_s *table, uint64_t coord_int);
+static inline uint64_t table_coord_int_at(coord_hash_table_s *table, size_t index) {
+    return *(uint64_t *)(table->entries + index * table->stride);
+}
 
-void free_coord_table(coord_hash_table_s *table);
+// only records anything when stats are enabled
+void record_hash_stats(char *name, coord_hash_table_s *table);
+
+bool table_contains_coord(coord_hash_table_s *table, uint64_t coord_int);
 
 #endif
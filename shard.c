@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <inttypes.h>
+#include <futile.h>
+#include "util.h"
+#include "hash.h"
+#include "stats.h"
+#include "shard.h"
+
+size_t shard_index(unsigned int prefix_zoom, uint64_t coord_int) {
+    futile_coord_s coord;
+    futile_coord_unmarshall_int(coord_int, &coord);
+    die_if(coord.z < 0 || coord.z > SHARD_MAX_ZOOM, "Cannot shard coord with zoom %d\n", coord.z);
+    unsigned int cell_zoom = coord.z < prefix_zoom ? coord.z : prefix_zoom;
+    unsigned int shift = coord.z - cell_zoom;
+    size_t cell_x = (size_t)coord.x >> shift;
+    size_t cell_y = (size_t)coord.y >> shift;
+    size_t cell = (cell_y << prefix_zoom) | cell_x;
+    return coord.z * shard_cells_per_zoom(prefix_zoom) + cell;
+}
+
+static size_t shard_index_key(uint64_t coord_int, void *data) {
+    return shard_index(*(unsigned int *)data, coord_int);
+}
+
+static void shard_path(char *path, size_t size, char *dir, unsigned int prefix_zoom, size_t index) {
+    unsigned int z = shard_zoom(prefix_zoom, index);
+    size_t cell = index % shard_cells_per_zoom(prefix_zoom);
+    int n = snprintf(path, size, "%s/z%u-%zu.bin", dir, z, cell);
+    die_if(n < 0 || n >= size, "Shard path too long: %s\n", dir);
+}
+
+static void manifest_path(char *path, size_t size, char *dir) {
+    int n = snprintf(path, size, "%s/%s", dir, SHARD_MANIFEST);
+    die_if(n < 0 || n >= size, "Shard path too long: %s\n", dir);
+}
+
+void write_shards(arena_s *arena, char *dir, unsigned int prefix_zoom,
+                  void *entries_, size_t n, size_t stride) {
+    die_if(prefix_zoom > SHARD_MAX_PREFIX_ZOOM, "Prefix zoom must be <= %d\n", SHARD_MAX_PREFIX_ZOOM);
+    uint8_t *entries = entries_;
+    size_t n_shards = (SHARD_MAX_ZOOM + 1) * shard_cells_per_zoom(prefix_zoom);
+
+    size_t mark = arena_mark(arena);
+    size_t *offsets = partition_in_place(
+        arena, entries, n, stride, n_shards, shard_index_key, &prefix_zoom);
+
+    char path[512];
+    manifest_path(path, sizeof(path), dir);
+    FILE *manifest = fopen(path, "w");
+    perr_die_if(!manifest, "fopen");
+    fprintf(manifest, "prefix_zoom %u\n", prefix_zoom);
+
+    for (size_t shard = 0; shard < n_shards; shard++) {
+        size_t count = offsets[shard + 1] - offsets[shard];
+        if (count == 0) continue;
+
+        shard_path(path, sizeof(path), dir, prefix_zoom, shard);
+        FILE *fh = fopen(path, "wb");
+        perr_die_if(!fh, "fopen");
+        perr_die_if(fwrite(entries + offsets[shard] * stride, stride, count, fh) != count, "fwrite");
+        perr_die_if(fclose(fh), "fclose");
+        stats_add_bytes_written(count * stride);
+
+        fprintf(manifest, "%zu %zu\n", shard, count);
+    }
+    perr_die_if(fclose(manifest), "fclose");
+
+    arena_pop_to(arena, mark);
+}
+
+shard_manifest_s read_shard_manifest(arena_s *arena, char *dir) {
+    char path[512];
+    manifest_path(path, sizeof(path), dir);
+    FILE *fh = fopen(path, "r");
+    perr_die_if(!fh, "fopen");
+
+    shard_manifest_s result = {};
+    die_if(fscanf(fh, "prefix_zoom %u\n", &result.prefix_zoom) != 1 ||
+           result.prefix_zoom > SHARD_MAX_PREFIX_ZOOM,
+           "Invalid shard manifest: %s\n", path);
+    result.n_shards = (SHARD_MAX_ZOOM + 1) * shard_cells_per_zoom(result.prefix_zoom);
+    result.counts = arena_push_array_zero(arena, uint64_t, result.n_shards);
+
+    size_t shard;
+    uint64_t count;
+    while (fscanf(fh, "%zu %" SCNu64 "\n", &shard, &count) == 2) {
+        die_if(shard >= result.n_shards, "Invalid shard in manifest: %zu\n", shard);
+        result.counts[shard] = count;
+    }
+    die_if(!feof(fh), "Invalid shard manifest: %s\n", path);
+    perr_die_if(fclose(fh), "fclose");
+    return result;
+}
+
+void *read_shard(arena_s *arena, char *dir, shard_manifest_s *manifest,
+                 size_t index, size_t stride) {
+    assert(index < manifest->n_shards);
+    uint64_t count = manifest->counts[index];
+    if (count == 0) {
+        return NULL;
+    }
+
+    char path[512];
+    shard_path(path, sizeof(path), dir, manifest->prefix_zoom, index);
+    FILE *fh = fopen(path, "rb");
+    perr_die_if(!fh, "fopen");
+    void *entries = arena_push_size(arena, count * stride, _Alignof(uint64_t));
+    die_if(fread(entries, stride, count, fh) != count, "Short shard: %s\n", path);
+    perr_die_if(fclose(fh), "fclose");
+    stats_add_bytes_read(count * stride);
+    return entries;
+}
+
+coord_shard_set_s open_coord_shards(arena_s *arena, char *dir) {
+    coord_shard_set_s result = {
+        .dir = dir,
+        .arena = arena,
+        .manifest = read_shard_manifest(arena, dir),
+    };
+    result.tables = arena_push_array_zero(arena, coord_hash_table_s, result.manifest.n_shards);
+    result.loaded = arena_push_array_zero(arena, bool, result.manifest.n_shards);
+    result.loaded_zoom = -1;
+    result.zoom_mark = arena_mark(arena);
+    return result;
+}
+
+bool shards_contain_coord(coord_shard_set_s *shards, uint64_t coord_int) {
+    size_t index = shard_index(shards->manifest.prefix_zoom, coord_int);
+    coord_hash_table_s *table = shards->tables + index;
+    int z = shard_zoom(shards->manifest.prefix_zoom, index);
+    if (z != shards->loaded_zoom) {
+        if (shards->loaded_zoom >= 0) {
+            size_t cells = shard_cells_per_zoom(shards->manifest.prefix_zoom);
+            size_t first = shards->loaded_zoom * cells;
+            memset(shards->tables + first, 0, sizeof(coord_hash_table_s) * cells);
+            memset(shards->loaded + first, 0, sizeof(bool) * cells);
+            arena_pop_to(shards->arena, shards->zoom_mark);
+        }
+        shards->loaded_zoom = z;
+    }
+    if (!shards->loaded[index]) {
+        stats_timer_s timer = stats_phase_begin("load_shard");
+        coord_ints_s coord_ints = {
+            .coord_ints = read_shard(shards->arena, shards->dir, &shards->manifest,
+                                     index, sizeof(uint64_t)),
+            .n = shards->manifest.counts[index],
+        };
+        if (coord_ints.n > 0) {
+            *table = create_coord_hash(shards->arena, &coord_ints);
+            record_hash_stats("toi", table);
+        }
+        shards->loaded[index] = true;
+        stats_phase_end(&timer);
+    }
+    return table->offsets && table_contains_coord(table, coord_int);
+}
@@ -0,0 +1,68 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include "util.h"
+#include "hash.h"
+
+// Scale mode splits a set of coords into shards on disk, one per zoom, and
+// optionally one per ancestor tile at prefix_zoom within each zoom. Each
+// shard is loaded and hashed on its own, so only the shards being worked
+// on need to be in memory rather than the whole set.
+//
+// A shard directory holds a shards.txt manifest and a z<z>-<cell>.bin file
+// for every non-empty shard, in the same format as the unsharded files.
+
+#define SHARD_MAX_ZOOM 20
+#define SHARD_MAX_PREFIX_ZOOM 8
+#define SHARD_MANIFEST "shards.txt"
+
+typedef struct {
+    unsigned int prefix_zoom;
+    size_t n_shards;
+    // entry count by shard index
+    uint64_t *counts;
+} shard_manifest_s;
+
+static inline size_t shard_cells_per_zoom(unsigned int prefix_zoom) {
+    return (size_t)1 << (2 * prefix_zoom);
+}
+
+size_t shard_index(unsigned int prefix_zoom, uint64_t coord_int);
+
+static inline unsigned int shard_zoom(unsigned int prefix_zoom, size_t index) {
+    return index / shard_cells_per_zoom(prefix_zoom);
+}
+
+// Partitions the entries in place by shard and writes every non-empty
+// shard plus the manifest into dir, which must already exist. Entries can
+// be any struct whose first member is the uint64_t coord int.
+void write_shards(arena_s *arena, char *dir, unsigned int prefix_zoom,
+                  void *entries, size_t n, size_t stride);
+
+shard_manifest_s read_shard_manifest(arena_s *arena, char *dir);
+
+// returns NULL for an empty shard
+void *read_shard(arena_s *arena, char *dir, shard_manifest_s *manifest,
+                 size_t index, size_t stride);
+
+// A lazily loaded set of coord shards, each shard is read and hashed the
+// first time a coord that falls into it is looked up. Only the shards of
+// one zoom are kept, looking up a coord at another zoom evicts them all, so
+// lookups should be grouped by zoom like futile_for_coord_zoom_range does.
+// Nothing may be pushed onto the arena while the set is in use.
+typedef struct {
+    char *dir;
+    arena_s *arena;
+    shard_manifest_s manifest;
+    coord_hash_table_s *tables;
+    bool *loaded;
+    // -1 when no shards are loaded
+    int loaded_zoom;
+    // the shards of loaded_zoom are everything past this
+    size_t zoom_mark;
+} coord_shard_set_s;
+
+coord_shard_set_s open_coord_shards(arena_s *arena, char *dir);
+bool shards_contain_coord(coord_shard_set_s *shards, uint64_t coord_int);
+
+#endif
@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "util.h"
+#include "stats.h"
+
+stats_s g_stats;
+
+static double clock_ms(clockid_t clock_id) {
+    struct timespec ts;
+    perr_die_if(clock_gettime(clock_id, &ts) != 0, "clock_gettime");
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+void stats_enable(char *tool, char *filename) {
+    memset(&g_stats, 0, sizeof(g_stats));
+    g_stats.enabled = true;
+    g_stats.tool = tool;
+    g_stats.filename = filename;
+}
+
+stats_timer_s stats_phase_begin(char *name) {
+    stats_timer_s result = {.phase_index = -1};
+    if (!g_stats.enabled) {
+        return result;
+    }
+
+    int phase_index = -1;
+    for (unsigned int i = 0; i < g_stats.n_phases; i++) {
+        if (strcmp(g_stats.phases[i].name, name) == 0) {
+            phase_index = i;
+            break;
+        }
+    }
+    if (phase_index < 0) {
+        die_if(g_stats.n_phases == STATS_MAX_PHASES, "Too many stats phases\n");
+        phase_index = g_stats.n_phases++;
+        g_stats.phases[phase_index].name = name;
+    }
+
+    result.phase_index = phase_index;
+    result.wall_start_ms = clock_ms(CLOCK_MONOTONIC);
+    result.cpu_start_ms = clock_ms(CLOCK_PROCESS_CPUTIME_ID);
+    return result;
+}
+
+void stats_phase_end(stats_timer_s *timer) {
+    if (timer->phase_index < 0) {
+        return;
+    }
+    stats_phase_s *phase = g_stats.phases + timer->phase_index;
+    phase->wall_ms += clock_ms(CLOCK_MONOTONIC) - timer->wall_start_ms;
+    phase->cpu_ms += clock_ms(CLOCK_PROCESS_CPUTIME_ID) - timer->cpu_start_ms;
+    phase->n_calls++;
+    timer->phase_index = -1;
+}
+
+stats_table_s *stats_add_table(char *name) {
+    if (!g_stats.enabled) {
+        return NULL;
+    }
+    for (unsigned int i = 0; i < g_stats.n_tables; i++) {
+        if (strcmp(g_stats.tables[i].name, name) == 0) {
+            return g_stats.tables + i;
+        }
+    }
+    if (g_stats.n_tables == STATS_MAX_TABLES) {
+        return NULL;
+    }
+    stats_table_s *table = g_stats.tables + g_stats.n_tables++;
+    memset(table, 0, sizeof(*table));
+    table->name = name;
+    return table;
+}
+
+static void write_json_histogram(FILE *fh, uint64_t *lengths) {
+    fputc('{', fh);
+    bool first = true;
+    for (unsigned int length = 0; length <= STATS_MAX_LENGTH; length++) {
+        if (lengths[length] > 0) {
+            fprintf(fh, "%s\"%u%s\": %" PRIu64,
+                first ? "" : ", ",
+                length, length == STATS_MAX_LENGTH ? "+" : "",
+                lengths[length]);
+            first = false;
+        }
+    }
+    fputc('}', fh);
+}
+
+void stats_write_json(FILE *fh) {
+    if (!g_stats.enabled) {
+        return;
+    }
+
+    struct rusage usage;
+    perr_die_if(getrusage(RUSAGE_SELF, &usage) != 0, "getrusage");
+
+    fprintf(fh, "{\n  \"tool\": \"%s\",\n", g_stats.tool);
+
+    fprintf(fh, "  \"phases\": [");
+    for (unsigned int i = 0; i < g_stats.n_phases; i++) {
+        stats_phase_s *phase = g_stats.phases + i;
+        fprintf(fh, "%s\n    {\"name\": \"%s\", \"calls\": %u, \"wall_ms\": %.3f, \"cpu_ms\": %.3f}",
+            i > 0 ? "," : "", phase->name, phase->n_calls, phase->wall_ms, phase->cpu_ms);
+    }
+    fprintf(fh, "%s],\n", g_stats.n_phases > 0 ? "\n  " : "");
+
+    fprintf(fh, "  \"io\": {\"bytes_read\": %" PRIu64 ", \"bytes_written\": %" PRIu64 "},\n",
+        g_stats.bytes_read, g_stats.bytes_written);
+    fprintf(fh, "  \"rows\": {\"parsed\": %" PRIu64 ", \"rejected\": %" PRIu64 "},\n",
+        g_stats.rows_parsed, g_stats.rows_rejected);
+
+    fprintf(fh, "  \"probes\": {\"count\": %" PRIu64 ", \"hits\": %" PRIu64 ", \"lengths\": ",
+        g_stats.n_probes, g_stats.n_probe_hits);
+    write_json_histogram(fh, g_stats.probe_lengths);
+    fprintf(fh, "},\n");
+
+    fprintf(fh, "  \"tables\": [");
+    for (unsigned int i = 0; i < g_stats.n_tables; i++) {
+        stats_table_s *table = g_stats.tables + i;
+        fprintf(fh, "%s\n    {\"name\": \"%s\", \"buckets\": %" PRIu64 ", \"entries\": %" PRIu64
+            ", \"empty_buckets\": %" PRIu64 ", \"chain_lengths\": ",
+            i > 0 ? "," : "", table->name, table->n_buckets, table->n_entries, table->n_empty_buckets);
+        write_json_histogram(fh, table->chain_lengths);
+        fputc('}', fh);
+    }
+    fprintf(fh, "%s],\n", g_stats.n_tables > 0 ? "\n  " : "");
+
+    fprintf(fh, "  \"arena_peak_bytes\": %" PRIu64 ",\n", g_stats.arena_peak_bytes);
+    // ru_maxrss is in kilobytes on linux
+    fprintf(fh, "  \"peak_rss_kb\": %ld\n}\n", usage.ru_maxrss);
+}
+
+void stats_report(void) {
+    if (!g_stats.enabled) {
+        return;
+    }
+    if (g_stats.filename) {
+        FILE *fh = fopen(g_stats.filename, "w");
+        perr_die_if(!fh, "fopen");
+        stats_write_json(fh);
+        perr_die_if(fclose(fh), "fclose");
+    } else {
+        stats_write_json(stderr);
+    }
+}
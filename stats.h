@@ -0,0 +1,115 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Lightweight instrumentation shared by all tools. Everything is recorded
+// into a single global, and every recording call is a no-op unless
+// stats_enable() was called, so the cost with --stats off is one
+// predictable branch.
+
+#define STATS_MAX_PHASES 32
+#define STATS_MAX_TABLES 8
+// probe and chain lengths at or above this are lumped into the last slot
+#define STATS_MAX_LENGTH 64
+
+typedef struct {
+    char *name;
+    double wall_ms;
+    double cpu_ms;
+    unsigned int n_calls;
+} stats_phase_s;
+
+typedef struct {
+    char *name;
+    uint64_t n_buckets;
+    uint64_t n_entries;
+    uint64_t n_empty_buckets;
+    uint64_t chain_lengths[STATS_MAX_LENGTH + 1];
+} stats_table_s;
+
+typedef struct {
+    bool enabled;
+    char *tool;
+    // NULL means stderr
+    char *filename;
+
+    stats_phase_s phases[STATS_MAX_PHASES];
+    unsigned int n_phases;
+
+    stats_table_s tables[STATS_MAX_TABLES];
+    unsigned int n_tables;
+
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+    uint64_t rows_parsed;
+    uint64_t rows_rejected;
+
+    // bytes mapped by all live arenas
+    uint64_t arena_bytes;
+    uint64_t arena_peak_bytes;
+
+    uint64_t n_probes;
+    uint64_t n_probe_hits;
+    uint64_t probe_lengths[STATS_MAX_LENGTH + 1];
+} stats_s;
+
+extern stats_s g_stats;
+
+typedef struct {
+    int phase_index;
+    double wall_start_ms;
+    double cpu_start_ms;
+} stats_timer_s;
+
+void stats_enable(char *tool, char *filename);
+
+// phases with the same name accumulate, so a phase can be begun in a loop
+stats_timer_s stats_phase_begin(char *name);
+void stats_phase_end(stats_timer_s *timer);
+
+// tables with the same name accumulate, e.g. one per shard
+stats_table_s *stats_add_table(char *name);
+
+void stats_write_json(FILE *fh);
+// writes the json to the filename given to stats_enable
+void stats_report(void);
+
+static inline void stats_add_bytes_read(uint64_t n) {
+    if (g_stats.enabled) g_stats.bytes_read += n;
+}
+
+static inline void stats_add_bytes_written(uint64_t n) {
+    if (g_stats.enabled) g_stats.bytes_written += n;
+}
+
+static inline void stats_add_rows(uint64_t n_parsed, uint64_t n_rejected) {
+    if (g_stats.enabled) {
+        g_stats.rows_parsed += n_parsed;
+        g_stats.rows_rejected += n_rejected;
+    }
+}
+
+static inline void stats_add_arena_bytes(int64_t delta) {
+    if (g_stats.enabled) {
+        g_stats.arena_bytes += delta;
+        if (g_stats.arena_bytes > g_stats.arena_peak_bytes) {
+            g_stats.arena_peak_bytes = g_stats.arena_bytes;
+        }
+    }
+}
+
+static inline void stats_record_probe(unsigned int length, bool hit) {
+    if (g_stats.enabled) {
+        g_stats.n_probes++;
+        g_stats.n_probe_hits += hit;
+        if (length > STATS_MAX_LENGTH) {
+            length = STATS_MAX_LENGTH;
+        }
+        g_stats.probe_lengths[length]++;
+    }
+}
+
+#endif
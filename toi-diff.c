@@ -8,9 +8,12 @@
 #include <futile.h>
 #include "util.h"
 #include "hash.h"
+#include "stats.h"
+#include "shard.h"
+#include "bitmap.h"
 
 void die_with_usage(char *prog) {
-    fprintf(stderr, "%s -f filename [minx,miny,maxx,maxy:z0-zn]\n", prog);
+    fprintf(stderr, "%s -f filename|-d shard_dir [--stats[=filename]] [--hugetlb] [--bitmap] [minx,miny,maxx,maxy:z0-zn]\n", prog);
     exit(EXIT_FAILURE);
 }
 
@@ -26,26 +29,32 @@ typedef struct {
 } coord_ranges_s;
 
 typedef struct {
+    // exactly one of these is set
     coord_hash_table_s *table;
-    unsigned int missing_coords[21];
+    coord_shard_set_s *shards;
+    coord_bitmap_s *bitmap;
+    uint64_t missing_coords[21];
 } for_coord_data_s;
 
 void for_coord_diff(futile_coord_s *coord, void *data_) {
     for_coord_data_s *data = data_;
     assert(coord->z >= 0 && coord->z <= 20);
     uint64_t coord_int = futile_coord_marshall_int(coord);
-    if (!table_contains_coord(data->table, coord_int)) {
+    bool contains;
+    if (data->table) {
+        contains = table_contains_coord(data->table, coord_int);
+    } else if (data->shards) {
+        contains = shards_contain_coord(data->shards, coord_int);
+    } else {
+        contains = bitmap_contains_coord(data->bitmap, coord_int);
+    }
+    if (!contains) {
         data->missing_coords[coord->z]++;
     }
 }
 
-void command_diff(coord_ints_s *coord_ints, coord_ranges_s *ranges) {
-    coord_hash_table_s table = create_coord_hash(coord_ints);
-
-    for_coord_data_s for_coord_data = {
-        .table = &table,
-    };
-    memset(for_coord_data.missing_coords, 0, sizeof(for_coord_data.missing_coords));
+void diff_ranges(for_coord_data_s *for_coord_data, coord_ranges_s *ranges) {
+    memset(for_coord_data->missing_coords, 0, sizeof(for_coord_data->missing_coords));
 
     for (unsigned int range_index = 0;
          range_index < ranges->n;
@@ -54,35 +63,94 @@ void command_diff(coord_ints_s *coord_ints, coord_ranges_s *ranges) {
             puts("");
         }
         coord_range_s *range = ranges->ranges + range_index;
+        stats_timer_s timer = stats_phase_begin("diff");
         futile_for_coord_zoom_range(
             range->minx, range->miny, range->maxx, range->maxy,
             range->zoom_start, range->zoom_until,
-            for_coord_diff, &for_coord_data);
+            for_coord_diff, for_coord_data);
+        stats_phase_end(&timer);
         for (unsigned int zoom_index = 0; zoom_index <= 20; zoom_index++) {
             if (zoom_index >= range->zoom_start && zoom_index <= range->zoom_until) {
-                printf("%2u: %u\n", zoom_index, for_coord_data.missing_coords[zoom_index]);
+                printf("%2u: %" PRIu64 "\n", zoom_index, for_coord_data->missing_coords[zoom_index]);
             }
         }
-        memset(for_coord_data.missing_coords, 0, sizeof(for_coord_data.missing_coords));
+        memset(for_coord_data->missing_coords, 0, sizeof(for_coord_data->missing_coords));
     }
 }
 
+void command_diff(arena_s *arena, coord_ints_s *coord_ints, coord_ranges_s *ranges) {
+    stats_timer_s timer = stats_phase_begin("build");
+    coord_hash_table_s table = create_coord_hash(arena, coord_ints);
+    stats_phase_end(&timer);
+    record_hash_stats("toi", &table);
+
+    for_coord_data_s for_coord_data = {
+        .table = &table,
+    };
+    diff_ranges(&for_coord_data, ranges);
+}
+
+void command_diff_bitmap(arena_s *arena, unsigned int arena_flags, coord_ints_s *coord_ints, coord_ranges_s *ranges) {
+    stats_timer_s timer = stats_phase_begin("build");
+    arena_s scratch = arena_create(arena_flags);
+    coord_bitmap_s bitmap = create_coord_bitmap(arena, &scratch, coord_ints->coord_ints, coord_ints->n);
+    arena_free(&scratch);
+    stats_phase_end(&timer);
+
+    for_coord_data_s for_coord_data = {
+        .bitmap = &bitmap,
+    };
+    diff_ranges(&for_coord_data, ranges);
+}
+
+void command_diff_shards(arena_s *arena, char *dir, coord_ranges_s *ranges) {
+    // shards are only loaded once a range touches them
+    coord_shard_set_s shards = open_coord_shards(arena, dir);
+    for_coord_data_s for_coord_data = {
+        .shards = &shards,
+    };
+    diff_ranges(&for_coord_data, ranges);
+}
+
 int main(int argc, char *argv[]) {
     char filename[256];
+    char dir[256];
     memset(filename, 0, sizeof(filename));
+    memset(dir, 0, sizeof(dir));
+    unsigned int arena_flags = ARENA_THP;
+    bool use_bitmap = false;
+
+    struct option long_options[] = {
+        {"stats", optional_argument, NULL, 's'},
+        {"hugetlb", no_argument, NULL, 'H'},
+        {"bitmap", no_argument, NULL, 'b'},
+        {0},
+    };
 
     int opt;
-    while ((opt = getopt(argc, argv, "f:")) != -1) {
+    while ((opt = getopt_long(argc, argv, "f:d:", long_options, NULL)) != -1) {
         switch (opt) {
             case 'f':
                 strncpy(filename, optarg, sizeof(filename)-1);
                 break;
+            case 'd':
+                strncpy(dir, optarg, sizeof(dir)-1);
+                break;
+            case 's':
+                stats_enable("toi-diff", optarg);
+                break;
+            case 'H':
+                arena_flags |= ARENA_HUGETLB;
+                break;
+            case 'b':
+                use_bitmap = true;
+                break;
             default:
                 die_with_usage(argv[0]);
         }
     }
 
-    if (!*filename || optind >= argc) {
+    if (!*filename == !*dir || optind >= argc) {
         die_with_usage(argv[0]);
     }
 
@@ -98,9 +166,23 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    coord_ints_s coord_ints = read_coord_ints(filename);
-    command_diff(&coord_ints, &ranges);
-    free_coord_ints(&coord_ints);
+    arena_s arena = arena_create(arena_flags);
+    if (*dir) {
+        die_if(use_bitmap, "--bitmap can't be used with shards\n");
+        command_diff_shards(&arena, dir, &ranges);
+    } else {
+        stats_timer_s timer = stats_phase_begin("read");
+        coord_ints_s coord_ints = read_coord_ints(&arena, filename);
+        stats_phase_end(&timer);
+        if (use_bitmap) {
+            command_diff_bitmap(&arena, arena_flags, &coord_ints, &ranges);
+        } else {
+            command_diff(&arena, &coord_ints, &ranges);
+        }
+    }
+    arena_free(&arena);
+
+    stats_report();
 
     return 0;
 }
@@ -4,171 +4,103 @@
 #include <stdlib.h>
 #include <memory.h>
 #include <math.h>
+#include <getopt.h>
 #define FUTILE_IMPLEMENTATION
 #include <futile.h>
 #include "hash.h"
 #include "util.h"
+#include "stats.h"
+#include "shard.h"
+#include "bitmap.h"
 
 typedef struct {
     uint64_t coord_int;
     unsigned int n;
 } tile_log_entry_s;
 
-typedef struct tile_log_chunk_s {
-    tile_log_entry_s *entries;
-    unsigned int n_entries;
-    struct tile_log_chunk_s *next;
-} tile_log_chunk_s;
-
 typedef struct {
-    tile_log_chunk_s *first;
-    unsigned int chunk_size;
-} tile_log_chunks_s;
+    tile_log_entry_s *entries;
+    size_t n;
+} tile_log_entries_s;
 
 typedef struct {
     // 0 -> z11 - counts for z11-20
-    unsigned int n_dropped_by_zoom[10];
+    uint64_t n_dropped_by_zoom[10];
 } prune_stat_s;
 
-void add_log_entry(tile_log_chunks_s *chunks, tile_log_entry_s *entry) {
-    tile_log_chunk_s *chunk = chunks->first;
-    if (!chunk || chunk->n_entries == chunks->chunk_size) {
-        chunk = malloc(sizeof(tile_log_chunk_s) + chunks->chunk_size * sizeof(tile_log_entry_s));
-        chunk->entries = (tile_log_entry_s *)(chunk + 1);
-        chunk->n_entries = 0;
-        chunk->next = chunks->first;
-        chunks->first = chunk;
-    }
-    chunk->entries[chunk->n_entries++] = *entry;
-}
-
-void free_tile_log_chunks(tile_log_chunks_s *chunks) {
-    tile_log_chunk_s *next, *cur;
-    for (cur = chunks->first; cur; cur = next) {
-        next = cur->next;
-        free(cur);
-    }
-}
-
-coord_hash_table_s create_log_entry_hash(tile_log_chunks_s *chunks) {
-    unsigned int n_log_entries = 0;
-    for (tile_log_chunk_s *chunk = chunks->first; chunk; chunk = chunk->next) {
-        n_log_entries += chunk->n_entries;
-    }
-
-    unsigned int hash_size = find_nearest_power_2_lower(n_log_entries);
-    unsigned int size_hash_entries = sizeof(coord_hash_entry_s) * n_log_entries;
-    unsigned int size_buckets = sizeof(coord_hash_entry_s *) * hash_size;
-    unsigned int total_mem_size = size_hash_entries + size_buckets;
-    void *memory = malloc(total_mem_size);
-    memset(memory, 0, total_mem_size);
-
-    coord_hash_entry_s **buckets = (coord_hash_entry_s **)memory;
-    coord_hash_entry_s *hash_entries = (coord_hash_entry_s *)(buckets + hash_size);
-
-    unsigned int hash_entry_index = 0;
-    for (tile_log_chunk_s *chunk = chunks->first; chunk; chunk = chunk->next) {
-        for (unsigned int log_index = 0; log_index < chunk->n_entries; log_index++) {
-            tile_log_entry_s *log_entry = chunk->entries + log_index;
-            coord_hash_entry_s *hash_entry = hash_entries + hash_entry_index++;
-            hash_entry->coord_int = log_entry->coord_int;
-
-            unsigned int hashcode = calc_coord_int_hash(log_entry->coord_int);
-            unsigned int bucket = hashcode & (hash_size - 1);
-
-            coord_hash_entry_s *location = buckets[bucket];
-            hash_entry->next = location;
-            buckets[bucket] = hash_entry;
-        }
-    }
-    coord_hash_table_s result = {
-        .buckets = buckets,
-        .size = hash_size,
-    };
-    return result;
+typedef struct {
+    // for arrays, the 0th element will start off at z11
+    uint64_t toi_counts_by_zoom[10];
+    // prune stats contains counts for 0-10
+    prune_stat_s prune_stats[11];
+} prune_counts_s;
+
+// grows in place while log_entries is the last allocation in the arena
+void add_log_entry(arena_s *arena, tile_log_entries_s *log_entries, tile_log_entry_s *entry) {
+    log_entries->entries = arena_extend(
+        arena, log_entries->entries, sizeof(tile_log_entry_s) * log_entries->n,
+        sizeof(tile_log_entry_s), _Alignof(tile_log_entry_s));
+    log_entries->entries[log_entries->n++] = *entry;
 }
 
-void command_prune_stats(coord_ints_s *toi, char *tile_logs_str) {
-    // for arrays, the 0th element will start off at z11
+// Adds the counts for one toi and log set to counts. The join is per coord,
+// so calling this once per shard gives the same result as one big call.
+void accumulate_prune_stats(arena_s *arena, prune_counts_s *counts,
+                            coord_ints_s *toi, tile_log_entries_s *log_entries) {
     unsigned int base = 11;
-
-    unsigned int toi_counts_by_zoom[10] = {};
-
-    FILE *in = fopen(tile_logs_str, "rb");
-    perr_die_if(!in, "fopen");
-    perr_die_if(fseek(in, 0, SEEK_END) != 0, "fseek");
-    long size = ftell(in);
-    perr_die_if(size < 0, "ftell");
-    perr_die_if(fseek(in, 0, SEEK_SET) != 0, "fseek");
-
-    unsigned int n_log_entries = size / sizeof(tile_log_entry_s);
-    coord_hash_table_s toi_table = create_coord_hash(toi);
-    tile_log_entry_s *log_entries = malloc(sizeof(tile_log_entry_s) * n_log_entries);
-    size_t n_read = fread(log_entries, sizeof(tile_log_entry_s), n_log_entries, in);
-    assert(n_read == n_log_entries);
-
-    unsigned int n_log_buckets = find_nearest_power_2_lower(n_log_entries);
-    coord_hash_entry_s *log_hash_entries = malloc(sizeof(coord_hash_entry_s) * n_log_entries);
-    coord_hash_entry_s **log_hash_buckets = malloc(sizeof(coord_hash_entry_s *) * n_log_entries);
-    unsigned int log_hash_entry_index = 0;
-    for (unsigned int log_entry_index = 0;
-         log_entry_index < n_log_entries;
-         log_entry_index++) {
-        tile_log_entry_s *log_entry = log_entries + log_entry_index;
-        unsigned int hash_code = calc_coord_int_hash(log_entry->coord_int);
-        unsigned int bucket_index = hash_code & (n_log_buckets - 1);
-        coord_hash_entry_s *new_entry = log_hash_entries + log_hash_entry_index++;
-        new_entry->coord_int = log_entry->coord_int;
-        new_entry->next = log_hash_buckets[bucket_index];
-        log_hash_buckets[bucket_index] = new_entry;
-    }
-    coord_hash_table_s log_table = {
-        .buckets = log_hash_buckets,
-        .size = n_log_buckets,
-    };
+    prune_stat_s *prune_stats = counts->prune_stats;
+    unsigned int n_prune_stats = arraycount(counts->prune_stats);
+
+    stats_timer_s timer = stats_phase_begin("build_toi");
+    coord_hash_table_s toi_table = create_coord_hash(arena, toi);
+    stats_phase_end(&timer);
+    record_hash_stats("toi", &toi_table);
+
+    timer = stats_phase_begin("build_log");
+    // NOTE: this reorders the log entries by bucket, the loop over them below
+    // doesn't depend on their order
+    coord_hash_table_s log_table = create_coord_hash_strided(
+        arena, log_entries->entries, log_entries->n, sizeof(tile_log_entry_s));
+    stats_phase_end(&timer);
+    record_hash_stats("log", &log_table);
 
     // for 0, all toi that are not in entries list
     // for > 0, all entries that are not in toi, with results starting at the entry counts
 
-    // prune stats contains counts for 0-10
-    prune_stat_s prune_stats[11] = {};
-    // probably not necessary, but just in case
-    memset(prune_stats, 0, sizeof(prune_stats));
-
     // NOTE: iterate through toi first, and all coords that don't exist in logs
     // are 0 requests
-    for (unsigned int toi_index = 0; toi_index < toi_table.size; toi_index++) {
-
-        for (coord_hash_entry_s *entry = toi_table.buckets[toi_index]; entry; entry = entry->next) {
+    timer = stats_phase_begin("join_toi");
+    for (size_t toi_index = 0; toi_index < toi->n; toi_index++) {
+        uint64_t coord_int = toi->coord_ints[toi_index];
 
-            futile_coord_s coord;
-            futile_coord_unmarshall_int(entry->coord_int, &coord);
+        futile_coord_s coord;
+        futile_coord_unmarshall_int(coord_int, &coord);
 
-            if (coord.z < 11 || coord.z > 20) continue;
+        if (coord.z < 11 || coord.z > 20) continue;
 
-            toi_counts_by_zoom[coord.z - base]++;
+        counts->toi_counts_by_zoom[coord.z - base]++;
 
-            if (!table_contains_coord(&log_table, entry->coord_int)) {
-                // assert(coord.z >= 11 && coord.z <= 20);
+        if (!table_contains_coord(&log_table, coord_int)) {
+            // assert(coord.z >= 11 && coord.z <= 20);
 
-                unsigned int drop_index = coord.z - base;
-                assert(drop_index >= 0 && drop_index < 10);
-                for (unsigned int prune_index = 0;
-                     prune_index < sizeof(prune_stats) / sizeof(prune_stats[0]);
-                     prune_index++) {
-                    prune_stat_s *prune_stat = prune_stats + prune_index;
-                    prune_stat->n_dropped_by_zoom[drop_index]++;
-                }
+            unsigned int drop_index = coord.z - base;
+            assert(drop_index >= 0 && drop_index < 10);
+            for (unsigned int prune_index = 0;
+                 prune_index < n_prune_stats;
+                 prune_index++) {
+                prune_stat_s *prune_stat = prune_stats + prune_index;
+                prune_stat->n_dropped_by_zoom[drop_index]++;
             }
         }
     }
-    free_coord_table(&log_table);
+    stats_phase_end(&timer);
 
     // NOTE: for each entry, count where dropped appropriately
-    for (unsigned int log_entry_index = 0;
-         log_entry_index < n_log_entries;
+    timer = stats_phase_begin("join_log");
+    for (size_t log_entry_index = 0;
+         log_entry_index < log_entries->n;
          log_entry_index++) {
-        tile_log_entry_s *entry = log_entries + log_entry_index;
+        tile_log_entry_s *entry = log_entries->entries + log_entry_index;
         if (entry->n > 10) continue;
         futile_coord_s coord;
         futile_coord_unmarshall_int(entry->coord_int, &coord);
@@ -178,7 +110,7 @@ void command_prune_stats(coord_ints_s *toi, char *tile_logs_str) {
         assert(drop_index >= 0 && drop_index < 10);
         if (table_contains_coord(&toi_table, entry->coord_int)) {
             for (unsigned int prune_index = entry->n;
-                 prune_index < sizeof(prune_stats) / sizeof(prune_stats[0]);
+                 prune_index < n_prune_stats;
                  prune_index++) {
                 assert(prune_index > 0);
                 prune_stat_s *prune_stat = prune_stats + prune_index;
@@ -186,35 +118,169 @@ void command_prune_stats(coord_ints_s *toi, char *tile_logs_str) {
             }
         }
     }
+    stats_phase_end(&timer);
+}
+
+// Same counts as accumulate_prune_stats, from per zoom bitmaps instead of
+// hash joins. The log is split by request count, 1-10 and over 10, and
+// each zoom only needs the size of the toi intersected with each of those.
+// NOTE: this assumes every coord is in the log at most once, which holds
+// for the grouped sql results.
+void accumulate_prune_stats_bitmap(arena_s *arena, arena_s *scratch, prune_counts_s *counts,
+                                   coord_ints_s *toi, tile_log_entries_s *log_entries) {
+    unsigned int base = 11;
+    // 0 is unused, 11 is everything with more than 10 requests
+    enum { n_classes = 12 };
+
+    stats_timer_s timer = stats_phase_begin("build_bitmaps");
+    coord_bitmap_s toi_bitmap = create_coord_bitmap(arena, scratch, toi->coord_ints, toi->n);
+
+    size_t class_counts[n_classes] = {};
+    for (size_t log_entry_index = 0; log_entry_index < log_entries->n; log_entry_index++) {
+        unsigned int n = log_entries->entries[log_entry_index].n;
+        class_counts[n > 10 ? 11 : n]++;
+    }
+    size_t mark = arena_mark(scratch);
+    uint64_t *class_coord_ints[n_classes];
+    size_t class_fill[n_classes] = {};
+    for (unsigned int class_index = 0; class_index < n_classes; class_index++) {
+        class_coord_ints[class_index] = arena_push_array(scratch, uint64_t, class_counts[class_index]);
+    }
+    for (size_t log_entry_index = 0; log_entry_index < log_entries->n; log_entry_index++) {
+        tile_log_entry_s *entry = log_entries->entries + log_entry_index;
+        unsigned int class_index = entry->n > 10 ? 11 : entry->n;
+        class_coord_ints[class_index][class_fill[class_index]++] = entry->coord_int;
+    }
+    coord_bitmap_s log_bitmaps[n_classes] = {};
+    for (unsigned int class_index = 1; class_index < n_classes; class_index++) {
+        if (class_counts[class_index] == 0) continue;
+        log_bitmaps[class_index] = create_coord_bitmap(
+            arena, scratch, class_coord_ints[class_index], class_counts[class_index]);
+    }
+    arena_pop_to(scratch, mark);
+    stats_phase_end(&timer);
+
+    timer = stats_phase_begin("join_bitmaps");
+    for (unsigned int z = 11; z <= 20; z++) {
+        unsigned int drop_index = z - base;
+        zoom_bitmap_s *toi_zoom = toi_bitmap.zooms + z;
+        uint64_t toi_count = zoom_bitmap_cardinality(toi_zoom);
+        counts->toi_counts_by_zoom[drop_index] += toi_count;
+
+        uint64_t n_in_log[n_classes];
+        uint64_t n_not_in_log = toi_count;
+        for (unsigned int class_index = 1; class_index < n_classes; class_index++) {
+            n_in_log[class_index] = zoom_bitmap_and_cardinality(
+                toi_zoom, log_bitmaps[class_index].zooms + z);
+            n_not_in_log -= n_in_log[class_index];
+        }
+
+        // pruning at n drops the toi missing from the log plus the toi
+        // requested at most n times
+        uint64_t n_dropped = n_not_in_log;
+        for (unsigned int prune_index = 0; prune_index < arraycount(counts->prune_stats); prune_index++) {
+            if (prune_index > 0) {
+                n_dropped += n_in_log[prune_index];
+            }
+            counts->prune_stats[prune_index].n_dropped_by_zoom[drop_index] += n_dropped;
+        }
+    }
+    stats_phase_end(&timer);
+}
+
+void print_prune_stats(prune_counts_s *counts) {
+    unsigned int base = 11;
 
     printf("Original toi:\n");
-    for (unsigned int toi_index = 0; toi_index < sizeof(toi_counts_by_zoom) / sizeof(toi_counts_by_zoom[0]); toi_index++) {
-        unsigned int toi_count = toi_counts_by_zoom[toi_index];
-        printf("%2d: %d\n", toi_index + base, toi_count);
+    for (unsigned int toi_index = 0; toi_index < arraycount(counts->toi_counts_by_zoom); toi_index++) {
+        uint64_t toi_count = counts->toi_counts_by_zoom[toi_index];
+        printf("%2d: %" PRIu64 "\n", toi_index + base, toi_count);
     }
     puts("\n");
 
-    for (unsigned int prune_index = 0; prune_index < sizeof(prune_stats) / sizeof(prune_stats[0]); prune_index++) {
-        prune_stat_s *prune_stat = prune_stats + prune_index;
+    for (unsigned int prune_index = 0; prune_index < arraycount(counts->prune_stats); prune_index++) {
+        prune_stat_s *prune_stat = counts->prune_stats + prune_index;
         printf("Pruned for request counts <= %u\n", prune_index);
-        for (unsigned int zoom_index = 0; zoom_index < sizeof(prune_stat->n_dropped_by_zoom) / sizeof(prune_stat->n_dropped_by_zoom[0]); zoom_index++) {
+        for (unsigned int zoom_index = 0; zoom_index < arraycount(prune_stat->n_dropped_by_zoom); zoom_index++) {
             unsigned int z = zoom_index + base;
-            unsigned int toi_count = toi_counts_by_zoom[zoom_index];
-            unsigned int prune_count = prune_stat->n_dropped_by_zoom[zoom_index];
+            uint64_t toi_count = counts->toi_counts_by_zoom[zoom_index];
+            uint64_t prune_count = prune_stat->n_dropped_by_zoom[zoom_index];
             assert(toi_count >= prune_count);
-            unsigned int new_count = toi_count - prune_count;
-            printf("%2u: %d\n", z, new_count);
+            uint64_t new_count = toi_count - prune_count;
+            printf("%2u: %" PRIu64 "\n", z, new_count);
         }
         puts("\n");
     }
+}
+
+// scratch selects the bitmap backend, NULL uses the hash tables
+void command_prune_stats(arena_s *arena, arena_s *scratch, coord_ints_s *toi, char *tile_logs_str) {
+    FILE *in = fopen(tile_logs_str, "rb");
+    perr_die_if(!in, "fopen");
+    perr_die_if(fseek(in, 0, SEEK_END) != 0, "fseek");
+    long size = ftell(in);
+    perr_die_if(size < 0, "ftell");
+    perr_die_if(fseek(in, 0, SEEK_SET) != 0, "fseek");
+
+    stats_timer_s timer = stats_phase_begin("read_log");
+    tile_log_entries_s log_entries = {
+        .n = size / sizeof(tile_log_entry_s),
+    };
+    log_entries.entries = arena_push_array(arena, tile_log_entry_s, log_entries.n);
+    size_t n_read = fread(log_entries.entries, sizeof(tile_log_entry_s), log_entries.n, in);
+    assert(n_read == log_entries.n);
+    perr_die_if(fclose(in), "fclose");
+    stats_add_bytes_read(n_read * sizeof(tile_log_entry_s));
+    stats_phase_end(&timer);
+
+    prune_counts_s counts = {};
+    if (scratch) {
+        accumulate_prune_stats_bitmap(arena, scratch, &counts, toi, &log_entries);
+    } else {
+        accumulate_prune_stats(arena, &counts, toi, &log_entries);
+    }
+    print_prune_stats(&counts);
+}
 
-    free_coord_table(&toi_table);
+void command_prune_stats_shards(arena_s *arena, arena_s *scratch, char *toi_dir, char *log_dir) {
+    shard_manifest_s toi_manifest = read_shard_manifest(arena, toi_dir);
+    shard_manifest_s log_manifest = read_shard_manifest(arena, log_dir);
+    die_if(toi_manifest.prefix_zoom != log_manifest.prefix_zoom,
+           "Toi and log shards must have the same prefix zoom\n");
+
+    // only one pair of shards is resident at a time
+    prune_counts_s counts = {};
+    size_t first_shard = 11 * shard_cells_per_zoom(toi_manifest.prefix_zoom);
+    for (size_t shard = first_shard; shard < toi_manifest.n_shards; shard++) {
+        if (toi_manifest.counts[shard] == 0) continue;
+
+        size_t mark = arena_mark(arena);
+        stats_timer_s timer = stats_phase_begin("read_shards");
+        coord_ints_s toi = {
+            .coord_ints = read_shard(arena, toi_dir, &toi_manifest, shard, sizeof(uint64_t)),
+            .n = toi_manifest.counts[shard],
+        };
+        tile_log_entries_s log_entries = {
+            .entries = read_shard(arena, log_dir, &log_manifest, shard, sizeof(tile_log_entry_s)),
+            .n = log_manifest.counts[shard],
+        };
+        stats_phase_end(&timer);
+
+        if (scratch) {
+            accumulate_prune_stats_bitmap(arena, scratch, &counts, &toi, &log_entries);
+        } else {
+            accumulate_prune_stats(arena, &counts, &toi, &log_entries);
+        }
+        arena_pop_to(arena, mark);
+    }
+    print_prune_stats(&counts);
 }
 
-void parse_log_entries(tile_log_chunks_s *chunks, char *filename) {
+void parse_log_entries(arena_s *arena, tile_log_entries_s *log_entries, char *filename) {
     FILE *fh = fopen(filename, "r");
     perr_die_if(!fh, "fopen");
 
+    uint64_t n_parsed = 0, n_rejected = 0;
     char buffer[64];
     while (fgets(buffer, sizeof(buffer)-1, fh) != NULL) {
         tile_log_entry_s entry;
@@ -224,6 +290,7 @@ void parse_log_entries(tile_log_chunks_s *chunks, char *filename) {
         if (z < 11 || z > 20 ||
             x < 0 || y < 0 ||
             x >= pow(2, z) || y >= pow(2, z)) {
+            n_rejected++;
             continue;
         }
         assert(n > 0);
@@ -236,43 +303,110 @@ void parse_log_entries(tile_log_chunks_s *chunks, char *filename) {
         entry.coord_int = coord_int;
         entry.n = n;
 
-        add_log_entry(chunks, &entry);
+        add_log_entry(arena, log_entries, &entry);
+        n_parsed++;
     }
 
+    if (g_stats.enabled) {
+        long size = ftell(fh);
+        perr_die_if(size < 0, "ftell");
+        stats_add_bytes_read(size);
+        stats_add_rows(n_parsed, n_rejected);
+    }
     perr_die_if(fclose(fh), "fclose");
 }
 
-void write_log_entries(tile_log_chunks_s *chunks, char *filename) {
+void write_log_entries(tile_log_entries_s *log_entries, char *filename) {
     FILE *fh = fopen(filename, "wb");
     perr_die_if(!fh, "fopen");
-    for (tile_log_chunk_s *chunk = chunks->first;
-         chunk;
-         chunk = chunk->next) {
-        perr_die_if(
-            fwrite(chunk->entries, sizeof(tile_log_entry_s), chunk->n_entries, fh) !=
-                chunk->n_entries, "fwrite");
-    }
+    perr_die_if(
+        fwrite(log_entries->entries, sizeof(tile_log_entry_s), log_entries->n, fh) !=
+            log_entries->n, "fwrite");
+    stats_add_bytes_written(log_entries->n * sizeof(tile_log_entry_s));
     perr_die_if(fclose(fh), "fclose");
 }
 
 int main(int argc, char *argv[]) {
-#define LOG_CHUNK_SIZE 4096 * 1000
+    unsigned int arena_flags = ARENA_THP;
+    // scale mode, the log (and for pruning the toi) are sharded
+    char *log_dir = NULL;
+    char *toi_dir = NULL;
+    unsigned int prefix_zoom = 0;
+    bool use_bitmap = false;
+    struct option long_options[] = {
+        {"stats", optional_argument, NULL, 's'},
+        {"hugetlb", no_argument, NULL, 'H'},
+        {"bitmap", no_argument, NULL, 'b'},
+        {0},
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "d:t:p:", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 's':
+                stats_enable("toi-log", optarg);
+                break;
+            case 'H':
+                arena_flags |= ARENA_HUGETLB;
+                break;
+            case 'b':
+                use_bitmap = true;
+                break;
+            case 'd':
+                log_dir = optarg;
+                break;
+            case 't':
+                toi_dir = optarg;
+                break;
+            case 'p':
+                die_if(sscanf(optarg, "%u", &prefix_zoom) != 1 || prefix_zoom > SHARD_MAX_PREFIX_ZOOM,
+                       "Prefix zoom must be between 0 and %d\n", SHARD_MAX_PREFIX_ZOOM);
+                break;
+            default:
+                die_if(true, "%s [--stats[=filename]] [--hugetlb] [--bitmap] [-d log_shard_dir [-p prefix_zoom]] [-t toi_shard_dir] sql-results.txt\n", argv[0]);
+        }
+    }
+
+    arena_s arena = arena_create(arena_flags);
 #if 1
     // create a binary file of log entries given the text sql results
-    die_if(argc != 2, "Specify sql results text file\n");
-    tile_log_chunks_s chunks = {
-        .chunk_size = LOG_CHUNK_SIZE,
-    };
-    for (unsigned int file_index = 1; file_index < argc; file_index++) {
+    die_if(argc - optind != 1, "Specify sql results text file\n");
+    die_if(toi_dir, "-t is only used when printing prune stats\n");
+    die_if(use_bitmap, "--bitmap is only used when printing prune stats\n");
+    tile_log_entries_s log_entries = {};
+    stats_timer_s timer = stats_phase_begin("parse");
+    for (unsigned int file_index = optind; file_index < argc; file_index++) {
         char *file_path = argv[file_index];
-        parse_log_entries(&chunks, file_path);
+        parse_log_entries(&arena, &log_entries, file_path);
+    }
+    stats_phase_end(&timer);
+
+    timer = stats_phase_begin("write");
+    if (log_dir) {
+        write_shards(&arena, log_dir, prefix_zoom,
+                     log_entries.entries, log_entries.n, sizeof(tile_log_entry_s));
+    } else {
+        write_log_entries(&log_entries, "log_entries.bin");
     }
-    write_log_entries(&chunks, "log_entries.bin");
-    free_tile_log_chunks(&chunks);
+    stats_phase_end(&timer);
 #else
     // read in the toi, the log entries, and print out the prune stats
-    coord_ints_s toi = read_coord_ints("toi.bin");
-    command_prune_stats(&toi, "log_entries.bin");
-    free_coord_ints(&toi);
+    arena_s scratch = {};
+    if (use_bitmap) {
+        scratch = arena_create(arena_flags);
+    }
+    if (log_dir || toi_dir) {
+        die_if(!log_dir || !toi_dir, "Both -d and -t are needed for sharded prune stats\n");
+        command_prune_stats_shards(&arena, use_bitmap ? &scratch : NULL, toi_dir, log_dir);
+    } else {
+        stats_timer_s timer = stats_phase_begin("read_toi");
+        coord_ints_s toi = read_coord_ints(&arena, "toi.bin");
+        stats_phase_end(&timer);
+        command_prune_stats(&arena, use_bitmap ? &scratch : NULL, &toi, "log_entries.bin");
+    }
+    arena_free(&scratch);
 #endif
+    arena_free(&arena);
+
+    stats_report();
 }
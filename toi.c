@@ -8,13 +8,16 @@
 #include <futile.h>
 #include <hiredis/hiredis.h>
 #include "util.h"
+#include "stats.h"
+#include "shard.h"
+#include "bitmap.h"
 
-coord_ints_s read_toi(char *redis_host) {
+coord_ints_s read_toi(arena_s *arena, char *redis_host) {
     redisContext *context = redisConnect(redis_host, 6379);
     die_if(context != NULL && context->err, "Redis connect error: %s\n", context->errstr);
     redisReply *reply = redisCommand(context, "SMEMBERS tilequeue.tiles-of-interest");
     die_if(reply == NULL, "Redis reply error: %s\n", context->errstr);
-    uint64_t *coord_ints = malloc(sizeof(uint64_t) * reply->elements);
+    uint64_t *coord_ints = arena_push_array(arena, uint64_t, reply->elements);
     size_t n = 0;
     for (size_t i = 0; i < reply->elements; i++) {
         redisReply *element = reply->element[i];
@@ -27,6 +30,7 @@ coord_ints_s read_toi(char *redis_host) {
         }
         coord_ints[n++] = coord_int;
     }
+    stats_add_rows(n, reply->elements - n);
     freeReplyObject(reply);
     redisFree(context);
 
@@ -39,13 +43,18 @@ void write_coord_ints(coord_ints_s *coord_ints, char *filename) {
     perr_die_if(!fh, "fopen");
     perr_die_if(fwrite(coord_ints->coord_ints, sizeof(uint64_t), coord_ints->n, fh) != coord_ints->n, "fwrite");
     perr_die_if(fclose(fh), "fclose");
+    stats_add_bytes_written(coord_ints->n * sizeof(uint64_t));
 }
 
-void command_print(char *filename) {
-    unsigned int zoom_counts[21] = {0};
-    unsigned int total = 0;
-    coord_ints_s coord_ints = read_coord_ints(filename);
+void command_print(unsigned int arena_flags, char *filename) {
+    uint64_t zoom_counts[21] = {0};
+    uint64_t total = 0;
+    arena_s arena = arena_create(arena_flags);
+    stats_timer_s timer = stats_phase_begin("read");
+    coord_ints_s coord_ints = read_coord_ints(&arena, filename);
+    stats_phase_end(&timer);
 
+    timer = stats_phase_begin("count");
     futile_coord_s coord;
     for (size_t coord_int_index = 0; coord_int_index < coord_ints.n; coord_int_index++) {
         uint64_t coord_int = coord_ints.coord_ints[coord_int_index];
@@ -56,30 +65,122 @@ void command_print(char *filename) {
         zoom_counts[coord.z] += 1;
         total++;
     }
+    stats_phase_end(&timer);
 
     for (int zoom_index = 0; zoom_index <= 20; zoom_index++) {
-        unsigned int zoom_count = zoom_counts[zoom_index];
-        printf("%2d: %u\n", zoom_index, zoom_count);
+        uint64_t zoom_count = zoom_counts[zoom_index];
+        printf("%2d: %" PRIu64 "\n", zoom_index, zoom_count);
     }
-    printf("Total: %u\n", total);
+    printf("Total: %" PRIu64 "\n", total);
 
-    free_coord_ints(&coord_ints);
+    arena_free(&arena);
 }
 
-void command_save(char *host, char *filename) {
-    coord_ints_s coord_ints = read_toi(host);
+void command_print_shards(unsigned int arena_flags, char *dir) {
+    uint64_t zoom_counts[21] = {0};
+    uint64_t total = 0;
+    arena_s arena = arena_create(arena_flags);
+
+    // the manifest has every count, none of the shards need to be read
+    shard_manifest_s manifest = read_shard_manifest(&arena, dir);
+    for (size_t shard = 0; shard < manifest.n_shards; shard++) {
+        zoom_counts[shard_zoom(manifest.prefix_zoom, shard)] += manifest.counts[shard];
+        total += manifest.counts[shard];
+    }
+
+    for (int zoom_index = 0; zoom_index <= 20; zoom_index++) {
+        uint64_t zoom_count = zoom_counts[zoom_index];
+        printf("%2d: %" PRIu64 "\n", zoom_index, zoom_count);
+    }
+    printf("Total: %" PRIu64 "\n", total);
+
+    arena_free(&arena);
+}
+
+void command_shard(unsigned int arena_flags, char *filename, char *dir, unsigned int prefix_zoom) {
+    arena_s arena = arena_create(arena_flags);
+    stats_timer_s timer = stats_phase_begin("read");
+    coord_ints_s coord_ints = read_coord_ints(&arena, filename);
+    stats_phase_end(&timer);
+
+    // drop anything past z20 like print does, it has no shard
+    size_t n = 0;
+    futile_coord_s coord;
+    for (size_t coord_int_index = 0; coord_int_index < coord_ints.n; coord_int_index++) {
+        uint64_t coord_int = coord_ints.coord_ints[coord_int_index];
+        futile_coord_unmarshall_int(coord_int, &coord);
+        if (coord.z > SHARD_MAX_ZOOM) {
+            continue;
+        }
+        coord_ints.coord_ints[n++] = coord_int;
+    }
+    stats_add_rows(n, coord_ints.n - n);
+    coord_ints.n = n;
+
+    timer = stats_phase_begin("write_shards");
+    write_shards(&arena, dir, prefix_zoom, coord_ints.coord_ints, coord_ints.n, sizeof(uint64_t));
+    stats_phase_end(&timer);
+
+    arena_free(&arena);
+}
+
+void command_save(unsigned int arena_flags, char *host, char *filename) {
+    arena_s arena = arena_create(arena_flags);
+    stats_timer_s timer = stats_phase_begin("read_redis");
+    coord_ints_s coord_ints = read_toi(&arena, host);
+    stats_phase_end(&timer);
+
+    timer = stats_phase_begin("write");
     write_coord_ints(&coord_ints, filename);
-    free_coord_ints(&coord_ints);
+    stats_phase_end(&timer);
+
+    arena_free(&arena);
+}
+
+void command_compare(unsigned int arena_flags, char *old_filename, char *new_filename) {
+    arena_s arena = arena_create(arena_flags);
+    arena_s scratch = arena_create(arena_flags);
+
+    stats_timer_s timer = stats_phase_begin("build_bitmaps");
+    coord_bitmap_s bitmaps[2];
+    char *filenames[2] = {old_filename, new_filename};
+    for (unsigned int i = 0; i < arraycount(bitmaps); i++) {
+        size_t mark = arena_mark(&scratch);
+        coord_ints_s coord_ints = read_coord_ints(&scratch, filenames[i]);
+        bitmaps[i] = create_coord_bitmap(&arena, &scratch, coord_ints.coord_ints, coord_ints.n);
+        arena_pop_to(&scratch, mark);
+    }
+    stats_phase_end(&timer);
+
+    timer = stats_phase_begin("compare");
+    for (int zoom_index = 0; zoom_index <= 20; zoom_index++) {
+        zoom_bitmap_s *old_zoom = bitmaps[0].zooms + zoom_index;
+        zoom_bitmap_s *new_zoom = bitmaps[1].zooms + zoom_index;
+        uint64_t old_count = zoom_bitmap_cardinality(old_zoom);
+        uint64_t new_count = zoom_bitmap_cardinality(new_zoom);
+        uint64_t both = zoom_bitmap_and_cardinality(old_zoom, new_zoom);
+        printf("%2d: %" PRIu64 " -> %" PRIu64 " (+%" PRIu64 " -%" PRIu64 ")\n",
+               zoom_index, old_count, new_count, new_count - both, old_count - both);
+    }
+    stats_phase_end(&timer);
+
+    arena_free(&scratch);
+    arena_free(&arena);
 }
 
 typedef enum {
     CMD_NONE,
     CMD_PRINT,
     CMD_SAVE,
+    CMD_SHARD,
+    CMD_COMPARE,
 } CMD;
 
 void die_with_usage(char *prog) {
-    fprintf(stderr, "%s print|save -f filename\n", prog);
+    fprintf(stderr, "%s print|save -f filename [--stats[=filename]] [--hugetlb]\n", prog);
+    fprintf(stderr, "%s print -d shard_dir\n", prog);
+    fprintf(stderr, "%s shard -f filename -d shard_dir [-p prefix_zoom]\n", prog);
+    fprintf(stderr, "%s compare -f old_filename -g new_filename\n", prog);
     exit(EXIT_FAILURE);
 }
 
@@ -87,7 +188,11 @@ int main(int argc, char *argv[]) {
 
     char filename[256];
     char host[256];
+    char dir[256];
+    char new_filename[256];
+    unsigned int prefix_zoom = 0;
     CMD cmd = CMD_NONE;
+    unsigned int arena_flags = ARENA_THP;
 
     if (argc < 2) {
         die_with_usage(argv[0]);
@@ -98,22 +203,50 @@ int main(int argc, char *argv[]) {
         cmd = CMD_PRINT;
     } else if (strcmp(command, "save") == 0) {
         cmd = CMD_SAVE;
+    } else if (strcmp(command, "shard") == 0) {
+        cmd = CMD_SHARD;
+    } else if (strcmp(command, "compare") == 0) {
+        cmd = CMD_COMPARE;
     } else {
         die_with_usage(argv[0]);
     }
 
     memset(filename, 0, sizeof(filename));
     memset(host, 0, sizeof(host));
+    memset(dir, 0, sizeof(dir));
+    memset(new_filename, 0, sizeof(new_filename));
+
+    struct option long_options[] = {
+        {"stats", optional_argument, NULL, 's'},
+        {"hugetlb", no_argument, NULL, 'H'},
+        {0},
+    };
 
     int opt;
-    while ((opt = getopt(argc - 1, argv + 1, "f:h:")) != -1) {
+    while ((opt = getopt_long(argc - 1, argv + 1, "f:g:h:d:p:", long_options, NULL)) != -1) {
         switch (opt) {
             case 'f':
                 strncpy(filename, optarg, sizeof(filename)-1);
                 break;
+            case 'g':
+                strncpy(new_filename, optarg, sizeof(new_filename)-1);
+                break;
             case 'h':
                 strncpy(host, optarg, sizeof(host)-1);
                 break;
+            case 'd':
+                strncpy(dir, optarg, sizeof(dir)-1);
+                break;
+            case 'p':
+                die_if(sscanf(optarg, "%u", &prefix_zoom) != 1 || prefix_zoom > SHARD_MAX_PREFIX_ZOOM,
+                       "Prefix zoom must be between 0 and %d\n", SHARD_MAX_PREFIX_ZOOM);
+                break;
+            case 's':
+                stats_enable("toi", optarg);
+                break;
+            case 'H':
+                arena_flags |= ARENA_HUGETLB;
+                break;
             default:
                 die_with_usage(argv[0]);
         }
@@ -121,17 +254,32 @@ int main(int argc, char *argv[]) {
 
     switch (cmd) {
         case CMD_PRINT:
-            die_if(*filename == '\0', "Missing filename\n");
-            command_print(filename);
+            if (*dir) {
+                command_print_shards(arena_flags, dir);
+            } else {
+                die_if(*filename == '\0', "Missing filename\n");
+                command_print(arena_flags, filename);
+            }
             break;
         case CMD_SAVE:
             die_if(*filename == '\0', "Missing filename\n");
             die_if(*host == '\0', "Missing host\n");
-            command_save(host, filename);
+            command_save(arena_flags, host, filename);
+            break;
+        case CMD_SHARD:
+            die_if(*filename == '\0', "Missing filename\n");
+            die_if(*dir == '\0', "Missing shard dir\n");
+            command_shard(arena_flags, filename, dir, prefix_zoom);
+            break;
+        case CMD_COMPARE:
+            die_if(*filename == '\0' || *new_filename == '\0', "Missing filename\n");
+            command_compare(arena_flags, filename, new_filename);
             break;
         default:
             INVALID_CODE_PATH;
     }
 
+    stats_report();
+
     return 0;
 }
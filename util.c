@@ -1,14 +1,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <inttypes.h>
+#include <assert.h>
+#include <string.h>
 #include "util.h"
+#include "stats.h"
 
-void free_coord_ints(coord_ints_s *coord_ints) {
-    free(coord_ints->coord_ints);
-    coord_ints->coord_ints = NULL;
-}
-
-coord_ints_s read_coord_ints(char *filename) {
+coord_ints_s read_coord_ints(arena_s *arena, char *filename) {
     FILE *fh = fopen(filename, "rb");
     perr_die_if(!fh, "fopen");
     perr_die_if(fseek(fh, 0, SEEK_END) != 0, "fseek");
@@ -16,9 +14,10 @@ coord_ints_s read_coord_ints(char *filename) {
     perr_die_if(size < 0, "ftell");
     perr_die_if(fseek(fh, 0, SEEK_SET) != 0, "fseek");
     long n_coords = size / sizeof(uint64_t);
-    uint64_t *coord_ints = malloc(size);
+    uint64_t *coord_ints = arena_push_array(arena, uint64_t, n_coords);
     perr_die_if(fread(coord_ints, sizeof(uint64_t), n_coords, fh) != n_coords, "fread");
     perr_die_if(fclose(fh), "fclose");
+    stats_add_bytes_read(n_coords * sizeof(uint64_t));
     coord_ints_s result = {
         .coord_ints = coord_ints,
         .n = n_coords,
@@ -26,25 +25,51 @@ coord_ints_s read_coord_ints(char *filename) {
     return result;
 }
 
-void add_coord_int(coord_chunks_s *chunks, uint64_t coord_int) {
-    coord_chunk_s *chunk = chunks->first;
-    if (!chunk || chunk->coord_ints.n == chunks->chunk_size) {
-        coord_chunk_s *new_chunk = malloc(
-                sizeof(coord_chunk_s) + sizeof(uint64_t) * chunks->chunk_size);
-        new_chunk->coord_ints.coord_ints = (uint64_t *)(new_chunk + 1);
-        new_chunk->coord_ints.n = 0;
-        new_chunk->next = chunk;
-        chunks->first = chunk = new_chunk;
-    }
-    chunk->coord_ints.coord_ints[chunk->coord_ints.n++] = coord_int;
+void add_coord_int(arena_s *arena, coord_ints_s *coord_ints, uint64_t coord_int) {
+    coord_ints->coord_ints = arena_extend(
+        arena, coord_ints->coord_ints, sizeof(uint64_t) * coord_ints->n,
+        sizeof(uint64_t), _Alignof(uint64_t));
+    coord_ints->coord_ints[coord_ints->n++] = coord_int;
 }
 
-void free_coord_chunks(coord_chunks_s *chunks) {
-    coord_chunk_s *next = 0;
-    for (coord_chunk_s *chunk = chunks->first;
-         chunk;
-         chunk = next) {
-        next = chunk->next;
-        free(chunk);
+size_t *partition_in_place(arena_s *arena, void *entries_, size_t n, size_t stride,
+                           size_t n_keys, partition_key_fn key_fn, void *key_data) {
+    uint8_t *entries = entries_;
+    uint8_t swap[32];
+    assert(stride >= sizeof(uint64_t) && stride <= sizeof(swap));
+
+    size_t *offsets = arena_push_array_zero(arena, size_t, n_keys + 1);
+
+    // count each key, then turn the counts into starting offsets
+    for (size_t entry_index = 0; entry_index < n; entry_index++) {
+        uint64_t coord_int = *(uint64_t *)(entries + entry_index * stride);
+        size_t key = key_fn(coord_int, key_data);
+        assert(key < n_keys);
+        offsets[key + 1]++;
     }
+    for (size_t key_index = 0; key_index < n_keys; key_index++) {
+        offsets[key_index + 1] += offsets[key_index];
+    }
+
+    // swap every entry directly into the next free slot of its key
+    size_t mark = arena_mark(arena);
+    size_t *next = arena_push_array(arena, size_t, n_keys);
+    memcpy(next, offsets, sizeof(size_t) * n_keys);
+    for (size_t key_index = 0; key_index < n_keys; key_index++) {
+        while (next[key_index] < offsets[key_index + 1]) {
+            uint8_t *entry = entries + next[key_index] * stride;
+            size_t key = key_fn(*(uint64_t *)entry, key_data);
+            if (key == key_index) {
+                next[key_index]++;
+            } else {
+                uint8_t *target = entries + next[key]++ * stride;
+                memcpy(swap, target, stride);
+                memcpy(target, entry, stride);
+                memcpy(entry, swap, stride);
+            }
+        }
+    }
+    arena_pop_to(arena, mark);
+
+    return offsets;
 }
@@ -1,6 +1,8 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+#include "arena.h"
+
 #define perr_die_if(cond, perr_str) if (cond) { perror(perr_str); exit(EXIT_FAILURE); }
 #define die_if(cond, err_str, ...) if (cond) { fprintf(stderr, err_str, ##__VA_ARGS__); exit(EXIT_FAILURE); }
 
@@ -12,20 +14,19 @@ typedef struct {
     size_t n;
 } coord_ints_s;
 
-coord_ints_s read_coord_ints(char *filename);
-void free_coord_ints(coord_ints_s *coord_ints);
+// the coord ints live in the arena, and are released with it
+coord_ints_s read_coord_ints(arena_s *arena, char *filename);
 
-typedef struct coord_chunk_s {
-    coord_ints_s coord_ints;
-    struct coord_chunk_s *next;
-} coord_chunk_s;
+// grows in place while coord_ints is the last allocation in the arena
+void add_coord_int(arena_s *arena, coord_ints_s *coord_ints, uint64_t coord_int);
 
-typedef struct {
-    coord_chunk_s *first;
-    unsigned int chunk_size;
-} coord_chunks_s;
+typedef size_t (*partition_key_fn)(uint64_t coord_int, void *data);
 
-void add_coord_int(coord_chunks_s *chunks, uint64_t coord_int);
-void free_coord_chunks(coord_chunks_s *chunks);
+// Reorders entries in place so that entries with the same key form
+// contiguous runs, key i being [offsets[i], offsets[i+1]). Entries can be
+// any struct whose first member is the uint64_t coord int. Returns the
+// n_keys + 1 offsets, allocated in the arena.
+size_t *partition_in_place(arena_s *arena, void *entries, size_t n, size_t stride,
+                           size_t n_keys, partition_key_fn key_fn, void *key_data);
 
 #endif